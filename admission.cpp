@@ -0,0 +1,44 @@
+#include "admission.h"
+#include "utility.h"
+
+#include <linux/filter.h>
+#include <sys/socket.h>
+
+#define INTERVAL_USEC (1000 * 1000 / ADMISSION_RATE)
+#define UDP_HEADER_LEN 8
+
+Admission::Admission() : full_at(ADMISSION_BUCKETS, 0), salt(get_timestamp()) {}
+
+bool Admission::admit(Connection const &address, uint64_t now) {
+    // FNV-1a over the address, salted so that senders cannot aim at a chosen bucket.
+    uint64_t hash = 14695981039346656037ULL ^ salt;
+    unsigned char const *bytes = (unsigned char const *)address.addr();
+    for (socklen_t i = 0; i < address.len(); i++) {
+        hash = (hash ^ bytes[i]) * 1099511628211ULL;
+    }
+
+    uint64_t &bucket = full_at[hash % ADMISSION_BUCKETS];
+    if (bucket < now) {
+        bucket = now;
+    }
+    if (bucket - now > (uint64_t)INTERVAL_USEC * (ADMISSION_BURST - 1)) {
+        return false;
+    }
+    bucket += INTERVAL_USEC;
+    return true;
+}
+
+bool attach_length_filter(int fd, uint32_t min_len, uint32_t max_len) {
+    /* On UDP sockets the filter sees the datagram with its UDP header. */
+    sock_filter code[] = {
+        BPF_STMT(BPF_LD | BPF_W | BPF_LEN, 0),
+        BPF_JUMP(BPF_JMP | BPF_JGE | BPF_K, UDP_HEADER_LEN + min_len, 0, 2),
+        BPF_JUMP(BPF_JMP | BPF_JGT | BPF_K, UDP_HEADER_LEN + max_len, 1, 0),
+        BPF_STMT(BPF_RET | BPF_K, 0xffffffff),
+        BPF_STMT(BPF_RET | BPF_K, 0),
+    };
+    sock_fprog program;
+    program.len = sizeof(code) / sizeof(code[0]);
+    program.filter = code;
+    return setsockopt(fd, SOL_SOCKET, SO_ATTACH_FILTER, &program, sizeof(program)) == 0;
+}
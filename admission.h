@@ -0,0 +1,32 @@
+#ifndef SK2_ADMISSION
+#define SK2_ADMISSION
+
+#include "connection.h"
+
+#include <cstdint>
+#include <vector>
+
+#define ADMISSION_BUCKETS 4096
+#define ADMISSION_RATE 100 // datagrams per second from one source
+#define ADMISSION_BURST 20
+
+/* Per-source rate limit checked before a datagram is decoded. Sources are hashed into a fixed table of token
+ * buckets, so a flood from random addresses costs no memory; sources sharing a bucket share its rate. A bucket
+ * is kept as the time at which it would be full again, which is the token bucket without a refill step. */
+class Admission {
+private:
+    std::vector<uint64_t> full_at;
+    uint64_t salt;
+
+public:
+    Admission();
+
+    /* Returns whether a datagram from address arriving at now (usec) fits in its source's rate. */
+    bool admit(Connection const &address, uint64_t now);
+};
+
+/* Attaches a classic BPF filter to fd that drops UDP datagrams with payload shorter than min_len or longer than
+ * max_len in the kernel. Returns false if the filter could not be attached. */
+bool attach_length_filter(int fd, uint32_t min_len, uint32_t max_len);
+
+#endif //SK2_ADMISSION
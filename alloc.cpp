@@ -0,0 +1,133 @@
+#include "alloc.h"
+
+#ifdef SCREEN_WORMS_ALLOC
+
+#include <algorithm>
+#include <atomic>
+#include <cinttypes>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <mutex>
+#include <new>
+
+/* Counts of one tag; tag 0 takes allocations made outside any scope. */
+struct AllocCounts {
+    char const *name;
+    std::atomic<uint64_t> allocs;
+    std::atomic<uint64_t> bytes;
+};
+
+static AllocCounts counts[ALLOC_MAX_TAGS];
+static size_t tags = 1;
+static std::mutex tags_mutex;
+static std::atomic<uint64_t> ticks(0);
+static std::atomic<uint64_t> datagrams(0);
+static volatile sig_atomic_t exit_requested = 0;
+
+/* Plain thread locals, so that finding the current tag never allocates. Scopes deeper than the stack are charged
+ * to the deepest one that fits. */
+static thread_local size_t stack[ALLOC_MAX_DEPTH];
+static thread_local size_t depth = 0;
+
+void *operator new(size_t size) {
+    AllocCounts &c = counts[depth == 0 ? 0 : stack[std::min<size_t>(depth, ALLOC_MAX_DEPTH) - 1]];
+    c.allocs.fetch_add(1, std::memory_order_relaxed);
+    c.bytes.fetch_add(size, std::memory_order_relaxed);
+    void *p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+/* Tags are looked up by name once per call site; when the table is full, new ones share tag 0. */
+size_t alloc_tag(char const *name) {
+    std::lock_guard<std::mutex> lock(tags_mutex);
+    for (size_t i = 1; i < tags; i++) {
+        if (strcmp(counts[i].name, name) == 0) {
+            return i;
+        }
+    }
+    if (tags == ALLOC_MAX_TAGS) {
+        return 0;
+    }
+    counts[tags].name = name;
+    return tags++;
+}
+
+void alloc_push(size_t tag) {
+    if (depth < ALLOC_MAX_DEPTH) {
+        stack[depth] = tag;
+    }
+    depth++;
+}
+
+void alloc_pop() {
+    depth--;
+}
+
+void alloc_tick() {
+    ticks.fetch_add(1, std::memory_order_relaxed);
+}
+
+void alloc_datagram() {
+    datagrams.fetch_add(1, std::memory_order_relaxed);
+}
+
+static double per(uint64_t count, uint64_t units) {
+    return units == 0 ? 0 : (double)count / units;
+}
+
+/* Written with stdio, which does not go through operator new. */
+static void report() {
+    char const *path = getenv("SCREEN_WORMS_ALLOC_FILE");
+    FILE *file = path != nullptr ? fopen(path, "w") : stderr;
+    if (file == nullptr) {
+        return;
+    }
+    uint64_t t = ticks.load(), d = datagrams.load(), all_allocs = 0, all_bytes = 0;
+    fprintf(file, "%" PRIu64 " ticks, %" PRIu64 " datagrams received\n", t, d);
+    fprintf(file, "tag\tallocs\tbytes\tallocs/tick\tallocs/datagram\n");
+    for (size_t i = 0; i < tags; i++) {
+        uint64_t allocs = counts[i].allocs.load(), bytes = counts[i].bytes.load();
+        all_allocs += allocs;
+        all_bytes += bytes;
+        if (allocs != 0) {
+            fprintf(file, "%s\t%" PRIu64 "\t%" PRIu64 "\t%.2f\t%.2f\n", i == 0 ? "untagged" : counts[i].name, allocs,
+                    bytes, per(allocs, t), per(allocs, d));
+        }
+    }
+    fprintf(file, "total\t%" PRIu64 "\t%" PRIu64 "\t%.2f\t%.2f\n", all_allocs, all_bytes, per(all_allocs, t),
+            per(all_allocs, d));
+    if (file != stderr) {
+        fclose(file);
+    }
+}
+
+static void request_exit(int) {
+    exit_requested = 1;
+}
+
+void alloc_setup() {
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_exit;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    atexit(report);
+}
+
+void alloc_poll() {
+    if (exit_requested) {
+        exit(EXIT_SUCCESS);
+    }
+}
+
+#endif
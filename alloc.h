@@ -0,0 +1,57 @@
+#ifndef SK2_ALLOC
+#define SK2_ALLOC
+
+/* Allocation accounting, compiled in only with -DSCREEN_WORMS_ALLOC (make alloc). operator new is replaced by one
+ * that counts allocations and bytes against the innermost ALLOC_SCOPE of the allocating thread. At exit the counts
+ * are written per tag, per tick and per received datagram, to the file named by SCREEN_WORMS_ALLOC_FILE or to
+ * standard error. Without the flag every macro expands to nothing. */
+
+#ifdef SCREEN_WORMS_ALLOC
+
+#include <cstddef>
+
+#define ALLOC_MAX_TAGS 32
+#define ALLOC_MAX_DEPTH 16
+
+size_t alloc_tag(char const *name);
+void alloc_push(size_t tag);
+void alloc_pop();
+void alloc_tick();
+void alloc_datagram();
+void alloc_setup();
+void alloc_poll();
+
+/* Charges allocations to a tag from its construction until the end of the enclosing scope. */
+class AllocScope {
+public:
+    explicit AllocScope(size_t tag) {
+        alloc_push(tag);
+    }
+    ~AllocScope() {
+        alloc_pop();
+    }
+};
+
+#define ALLOC_JOIN(a, b) a##b
+#define ALLOC_SCOPE_AT(name, line)                                         \
+    static size_t const ALLOC_JOIN(alloc_tag_, line) = alloc_tag(name); \
+    AllocScope ALLOC_JOIN(alloc_scope_, line)(ALLOC_JOIN(alloc_tag_, line))
+#define ALLOC_SCOPE(name) ALLOC_SCOPE_AT(name, __LINE__)
+/* Counts a game tick or a received datagram, the units of the report. */
+#define ALLOC_TICK() alloc_tick()
+#define ALLOC_DATAGRAM() alloc_datagram()
+/* Reports at exit, and makes SIGINT and SIGTERM exit through ALLOC_POLL. */
+#define ALLOC_SETUP() alloc_setup()
+#define ALLOC_POLL() alloc_poll()
+
+#else
+
+#define ALLOC_SCOPE(name) do {} while (0)
+#define ALLOC_TICK() do {} while (0)
+#define ALLOC_DATAGRAM() do {} while (0)
+#define ALLOC_SETUP() do {} while (0)
+#define ALLOC_POLL() do {} while (0)
+
+#endif
+
+#endif //SK2_ALLOC
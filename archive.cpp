@@ -0,0 +1,178 @@
+#include "archive.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+ArchiveError::ArchiveError(char const *err) : std::runtime_error(err) {}
+
+static uint32_t read_uint32(char const *p) {
+    uint32_t val;
+    memcpy(&val, p, sizeof(val));
+    return be32toh(val);
+}
+
+bool write_archived_game(int fd, Game &game, uint32_t rounds_per_sec) {
+    auto &events = game.get_events();
+    auto &tick_starts = game.get_tick_starts();
+
+    Codec index;
+    uint32_t data_len = 0;
+    for (size_t n = 0; n < events.size(); n++) {
+        if (n % ARCHIVE_INDEX_INTERVAL == 0) {
+            index.add_uint32_t(data_len);
+        }
+        data_len += events[n]->get_len();
+    }
+    for (auto start : tick_starts) {
+        index.add_uint32_t(start);
+    }
+
+    Codec record;
+    record.add_uint32_t(ARCHIVE_MAGIC);
+    record.add_uint32_t(ARCHIVE_HEADER_LEN + data_len + index.get_len());
+    record.add_uint32_t(game.get_game_id());
+    record.add_uint32_t(rounds_per_sec);
+    record.add_uint32_t(game.get_width());
+    record.add_uint32_t(game.get_height());
+    record.add_uint32_t(events.size());
+    record.add_uint32_t(tick_starts.size());
+    record.add_uint32_t(data_len);
+    for (auto &event : events) {
+        record.add(event->get_data(), event->get_len());
+    }
+    record.add(index.get_data(), index.get_len());
+
+    // O_APPEND makes the single write land at the end even with several writers.
+    return write(fd, record.get_data(), record.get_len()) == (ssize_t)record.get_len();
+}
+
+char const *ArchivedGame::event(uint32_t n, uint32_t &len) const {
+    char const *p = data + read_uint32(event_index + n / ARCHIVE_INDEX_INTERVAL * 4);
+    for (uint32_t skipped = n % ARCHIVE_INDEX_INTERVAL; skipped > 0; skipped--) {
+        p += 4 + read_uint32(p) + 4;
+    }
+    len = 4 + read_uint32(p) + 4;
+    return p;
+}
+
+uint32_t ArchivedGame::first_event_of_tick(uint32_t tick) const {
+    return tick < tick_count ? read_uint32(tick_index + tick * 4) : event_count;
+}
+
+/* Checks that the events chain through exactly data_len bytes where the event index says they start, and that
+ * ticks start at events in order, so that event() and first_event_of_tick() stay within the record. */
+static bool valid_indices(ArchivedGame const &game) {
+    uint32_t offset = 0;
+    for (uint32_t n = 0; n < game.event_count; n++) {
+        bool indexed = n % ARCHIVE_INDEX_INTERVAL == 0;
+        if (indexed && read_uint32(game.event_index + n / ARCHIVE_INDEX_INTERVAL * 4) != offset) {
+            return false;
+        }
+        if (game.data_len - offset < 8) {
+            return false;
+        }
+        uint64_t len = 4 + (uint64_t)read_uint32(game.data + offset) + 4;
+        if (len > game.data_len - offset) {
+            return false;
+        }
+        offset += len;
+    }
+    if (offset != game.data_len) {
+        return false;
+    }
+    uint32_t previous = 0;
+    for (uint32_t tick = 0; tick < game.tick_count; tick++) {
+        uint32_t first = read_uint32(game.tick_index + tick * 4);
+        if (first < previous || first > game.event_count) {
+            return false;
+        }
+        previous = first;
+    }
+    return true;
+}
+
+Archive::Archive(std::string const &path) {
+    fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        release();
+        throw ArchiveError("couldn't open archive");
+    }
+    size = st.st_size;
+    if (size > 0) {
+        map = (char *)mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (map == MAP_FAILED) {
+            map = nullptr;
+            release();
+            throw ArchiveError("couldn't map archive");
+        }
+    }
+
+    size_t offset = 0;
+    while (size - offset >= ARCHIVE_HEADER_LEN) {
+        char const *header = map + offset;
+        uint32_t record_len = read_uint32(header + 4);
+        if (read_uint32(header) != ARCHIVE_MAGIC || record_len < ARCHIVE_HEADER_LEN || record_len > size - offset) {
+            break;
+        }
+
+        ArchivedGame game;
+        game.game_id = read_uint32(header + 8);
+        game.rounds_per_sec = read_uint32(header + 12);
+        game.width = read_uint32(header + 16);
+        game.height = read_uint32(header + 20);
+        game.event_count = read_uint32(header + 24);
+        game.tick_count = read_uint32(header + 28);
+        game.data_len = read_uint32(header + 32);
+        uint64_t index_len = ((uint64_t)game.event_count + ARCHIVE_INDEX_INTERVAL - 1) / ARCHIVE_INDEX_INTERVAL * 4 +
+                             (uint64_t)game.tick_count * 4;
+        if ((uint64_t)ARCHIVE_HEADER_LEN + game.data_len + index_len != record_len) {
+            break;
+        }
+        game.data = header + ARCHIVE_HEADER_LEN;
+        game.event_index = game.data + game.data_len;
+        game.tick_index =
+            game.event_index + (game.event_count + ARCHIVE_INDEX_INTERVAL - 1) / ARCHIVE_INDEX_INTERVAL * 4;
+        games.push_back(game);
+        offset += record_len;
+    }
+
+    if (games.empty()) {
+        release();
+        throw ArchiveError("no games in archive");
+    }
+    validity.assign(games.size(), UNCHECKED);
+}
+
+Archive::~Archive() {
+    release();
+}
+
+void Archive::release() {
+    if (map != nullptr) {
+        munmap(map, size);
+        map = nullptr;
+    }
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+    }
+}
+
+size_t Archive::get_game_count() {
+    return games.size();
+}
+
+ArchivedGame const &Archive::get_game(size_t i) {
+    return games[i];
+}
+
+bool Archive::is_valid(size_t i) {
+    if (validity[i] == UNCHECKED) {
+        validity[i] = valid_indices(games[i]) ? VALID : INVALID;
+    }
+    return validity[i] == VALID;
+}
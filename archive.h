@@ -0,0 +1,75 @@
+#ifndef SK2_ARCHIVE
+#define SK2_ARCHIVE
+
+#include "game.h"
+
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+#define ARCHIVE_MAGIC 0x53574131 // "SWA1"
+#define ARCHIVE_INDEX_INTERVAL 64
+#define ARCHIVE_HEADER_LEN (9 * 4)
+
+/* Game archive: an append-only file of finished games. Each record is
+ *   header: magic, record length, game id, rounds per second, width, height, event count, tick count, data length
+ *   data: the game's events exactly as sent, one after another
+ *   event index: offset in data of every ARCHIVE_INDEX_INTERVAL-th event
+ *   tick index: number of the first event of every tick, tick 0 being the start of the game
+ * with all numbers big-endian uint32. Records are found by their lengths. Only headers are read when the archive is
+ * opened; a game's events are walked against its indices the first time it is served. */
+
+class ArchiveError : public std::runtime_error {
+public:
+    ArchiveError(char const *err);
+};
+
+/* Appends the finished game to the archive open in fd. Returns false if it could not be written. */
+bool write_archived_game(int fd, Game &game, uint32_t rounds_per_sec);
+
+/* A game in a mapped archive. */
+struct ArchivedGame {
+    uint32_t game_id;
+    uint32_t rounds_per_sec;
+    uint32_t width, height;
+    uint32_t event_count;
+    uint32_t tick_count;
+    char const *data;
+    uint32_t data_len;
+    char const *event_index;
+    char const *tick_index;
+
+    /* Returns the event numbered n, as sent, and its length. */
+    char const *event(uint32_t n, uint32_t &len) const;
+    /* Returns the number of the first event of tick, or event_count past the last tick. */
+    uint32_t first_event_of_tick(uint32_t tick) const;
+};
+
+/* Archive mapped read-only. Throws ArchiveError if the file cannot be mapped or holds no games. A record cut short
+ * at the end of the file, by a crash while appending, is ignored. */
+class Archive {
+private:
+    enum Validity : uint8_t { UNCHECKED, VALID, INVALID };
+
+    int fd = -1;
+    char *map = nullptr;
+    size_t size = 0;
+    std::vector<ArchivedGame> games;
+    std::vector<Validity> validity;
+
+    void release();
+
+public:
+    explicit Archive(std::string const &path);
+    Archive(const Archive &) = delete;
+    Archive &operator=(const Archive &) = delete;
+    ~Archive();
+
+    size_t get_game_count();
+    ArchivedGame const &get_game(size_t i);
+    /* Returns whether the indices of game i stay within its record, checking them the first time. */
+    bool is_valid(size_t i);
+};
+
+#endif //SK2_ARCHIVE
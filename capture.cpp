@@ -0,0 +1,90 @@
+#include "capture.h"
+#include "codec.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+CaptureRing::CaptureRing() : ring(CAPTURE_RING_DATAGRAMS) {}
+
+void CaptureRing::record(Connection const &from, char const *data, ssize_t len, uint64_t timestamp) {
+    CapturedDatagram &d = ring[next];
+    d.timestamp = timestamp;
+    d.from = from;
+    d.len = std::min<ssize_t>(std::max<ssize_t>(len, 0), MAX_RECEIVED_DATAGRAM);
+    memcpy(d.data, data, d.len);
+    if (++next == ring.size()) {
+        next = 0;
+        wrapped = true;
+    }
+}
+
+bool CaptureRing::dump(std::string const &path) {
+    size_t count = wrapped ? ring.size() : next;
+    Codec file;
+    file.add_uint32_t(CAPTURE_MAGIC);
+    file.add_uint32_t(count);
+    for (size_t i = 0; i < count; i++) {
+        CapturedDatagram &d = ring[wrapped ? (next + i) % ring.size() : i];
+        file.add_uint64_t(d.timestamp);
+        file.add_uint32_t(d.from.len());
+        file.add((void *)d.from.addr(), d.from.len());
+        file.add_uint32_t(d.len);
+        file.add(d.data, d.len);
+    }
+
+    int fd = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return false;
+    }
+    bool written = write(fd, file.get_data(), file.get_len()) == (ssize_t)file.get_len();
+    close(fd);
+    return written;
+}
+
+bool load_capture(std::string const &path, std::vector<CapturedDatagram> &datagrams) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1) {
+        return false;
+    }
+    Codec file(st.st_size);
+    bool read_all = read(fd, file.get_data(), file.get_len()) == (ssize_t)file.get_len();
+    close(fd);
+    if (!read_all) {
+        return false;
+    }
+
+    try {
+        if (file.read_uint32_t() != CAPTURE_MAGIC) {
+            return false;
+        }
+        uint32_t count = file.read_uint32_t();
+        if (count > file.get_remaining() / (8 + 4 + 4)) {
+            return false;
+        }
+        datagrams.resize(count);
+        for (auto &d : datagrams) {
+            d.timestamp = file.read_uint64_t();
+            uint32_t len = file.read_uint32_t();
+            if (len > sizeof(sockaddr_storage) || file.get_remaining() < len) {
+                return false;
+            }
+            memcpy(d.from.addr(), file.get_pos(), len);
+            d.from.len() = len;
+            file.skip_pos(len);
+            len = file.read_uint32_t();
+            if (len > MAX_RECEIVED_DATAGRAM || file.get_remaining() < len) {
+                return false;
+            }
+            d.len = len;
+            memcpy(d.data, file.get_pos(), len);
+            file.skip_pos(len);
+        }
+    } catch (CodecError const &e) {
+        return false;
+    }
+    return true;
+}
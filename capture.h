@@ -0,0 +1,46 @@
+#ifndef SK2_CAPTURE
+#define SK2_CAPTURE
+
+#include "connection.h"
+#include "reactor.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define CAPTURE_MAGIC 0x53574331 // "SWC1"
+#define CAPTURE_RING_DATAGRAMS 16384
+
+/* Inbound datagram as captured: when it was received (usec, monotonic), from where, and its first
+ * MAX_RECEIVED_DATAGRAM bytes. */
+struct CapturedDatagram {
+    uint64_t timestamp;
+    Connection from;
+    uint16_t len;
+    char data[MAX_RECEIVED_DATAGRAM];
+};
+
+/* Capture file: magic and datagram count, then for every datagram its timestamp (uint64), address length and
+ * address, data length and data, oldest first; numbers big-endian. */
+
+/* Ring of the last CAPTURE_RING_DATAGRAMS inbound datagrams. Memory is allocated up front, recording a datagram
+ * is a copy. */
+class CaptureRing {
+private:
+    std::vector<CapturedDatagram> ring;
+    size_t next = 0;
+    bool wrapped = false;
+
+public:
+    CaptureRing();
+
+    void record(Connection const &from, char const *data, ssize_t len, uint64_t timestamp);
+
+    /* Writes the ring to a capture file at path. Returns false if it could not be written. */
+    bool dump(std::string const &path);
+};
+
+/* Reads a capture file. Returns false if it cannot be read or is malformed. */
+bool load_capture(std::string const &path, std::vector<CapturedDatagram> &datagrams);
+
+#endif //SK2_CAPTURE
@@ -1,16 +1,25 @@
 #include "client.h"
 
+#include "trace.h"
 #include "utility.h"
 
+#include <algorithm>
+
 Client::Client(int argc, char *argv[]) {
     // Parsing arguments.
     std::string server_name, gui_server = "localhost";
-    uint32_t server_port = DEFAULT_SERVER_PORT, gui_port = DEFAULT_GUI_PORT;
+    std::string multicast_group;
+    uint32_t server_port = DEFAULT_SERVER_PORT, gui_port = DEFAULT_GUI_PORT, multicast_port = DEFAULT_MULTICAST_PORT;
     player_name = "";
 
     int opt;
-    while ((opt = getopt(argc, argv, "n:p:i:r")) != -1) {
+    while ((opt = getopt(argc, argv, "n:p:i:r:d:m:M:l")) != -1) {
         uint32_t parsed;
+        if (opt == 'l') {
+            // An observer that wants every tick instead of the server's batches.
+            realtime_updates = true;
+            continue;
+        }
         if (optarg == NULL) {
             exit(EXIT_FAILURE);
         }
@@ -40,6 +49,27 @@ Client::Client(int argc, char *argv[]) {
                 }
                 gui_port = parsed;
                 break;
+            case 'd':
+                try {
+                    parsed = string_to_uint32_t(optarg);
+                } catch (UtilityError const &e) {
+                    std::cerr << static_cast<char>(opt) << ": " << e.what() << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+                max_datagram_len = parsed;
+                break;
+            case 'm':
+                multicast_group = optarg;
+                break;
+            case 'M':
+                try {
+                    parsed = string_to_uint32_t(optarg);
+                } catch (UtilityError const &e) {
+                    std::cerr << static_cast<char>(opt) << ": " << e.what() << std::endl;
+                    exit(EXIT_FAILURE);
+                }
+                multicast_port = parsed;
+                break;
             default:
                 std::cerr << "Invalid command\n";
                 exit(EXIT_FAILURE);
@@ -52,6 +82,11 @@ Client::Client(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    if (max_datagram_len < MAX_DATAGRAM_SIZE || max_datagram_len > MAX_UDP_PAYLOAD) {
+        std::cerr << "Datagram size should be in [" << MAX_DATAGRAM_SIZE << ", " << MAX_UDP_PAYLOAD << "] range\n";
+        exit(EXIT_FAILURE);
+    }
+
     try {
         validate_playername(player_name);
     } catch (UtilityError const &e) {
@@ -91,6 +126,16 @@ Client::Client(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
+    // Only observers take live events from the multicast group.
+    if (!multicast_group.empty() && player_name.empty()) {
+        join_multicast(multicast_group, multicast_port);
+    }
+
+    if (max_datagram_len != MAX_DATAGRAM_SIZE) {
+        int rcvbuf = max_datagram_len * RECEIVE_BUFFER_DATAGRAMS;
+        setsockopt(server_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+    }
+
     struct addrinfo guihints = {};
     guihints.ai_family = AF_UNSPEC;
     guihints.ai_socktype = SOCK_STREAM;
@@ -115,6 +160,42 @@ Client::Client(int argc, char *argv[]) {
     polls[1].fd = gui_fd;
     polls[1].events = POLLIN;
     polls[1].revents = 0;
+
+    polls[2].fd = multicast_fd;
+    polls[2].events = POLLIN;
+    polls[2].revents = 0;
+}
+
+/* Opens a socket subscribed to the server's multicast group. A scope id in the group address ("ff02::1%eth0")
+ * picks the interface. */
+void Client::join_multicast(std::string const &group, uint32_t port) {
+    struct addrinfo hints = {};
+    hints.ai_family = AF_INET6;
+    hints.ai_socktype = SOCK_DGRAM;
+    hints.ai_flags = AI_NUMERICHOST;
+    Connection group_conn(group.c_str(), port, hints);
+    sockaddr_in6 *group_ip = (sockaddr_in6 *)group_conn.addr();
+    if (!IN6_IS_ADDR_MULTICAST(&group_ip->sin6_addr)) {
+        std::cerr << "Incorrect multicast group\n";
+        exit(EXIT_FAILURE);
+    }
+
+    multicast_fd = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (multicast_fd == -1) {
+        std::cerr << "Couldn't setup multicast socket\n";
+        exit(EXIT_FAILURE);
+    }
+
+    ipv6_mreq mreq;
+    mreq.ipv6mr_multiaddr = group_ip->sin6_addr;
+    mreq.ipv6mr_interface = group_ip->sin6_scope_id;
+    int flag = 1;
+    if (setsockopt(multicast_fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag)) == -1 ||
+        bind(multicast_fd, (sockaddr *)group_conn.addr(), group_conn.len()) == -1 ||
+        setsockopt(multicast_fd, IPPROTO_IPV6, IPV6_JOIN_GROUP, &mreq, sizeof(mreq)) == -1) {
+        std::cerr << "Couldn't join multicast group\n";
+        exit(EXIT_FAILURE);
+    }
 }
 
 void Client::connect_to_gui() {
@@ -133,48 +214,69 @@ void Client::connect_to_server() {
 
 void Client::run() {
     while (1) {
-        for (size_t i = 0; i < 2; i++) polls[i].revents = 0;
+        for (size_t i = 0; i < 3; i++) polls[i].revents = 0;
         polls[0].events = (!write_to_server) ? POLLIN : (POLLIN | POLLOUT);
         polls[1].events = (!write_to_gui) ? POLLIN : (POLLIN | POLLOUT);
 
-        int ret = poll(polls, 2, -1);
-        if (ret <= 0) continue;
+        /* Sleep until the next heartbeat or redundant copy of a turn is due. */
+        uint64_t now = get_timestamp();
+        uint64_t due = last_client_info_send + heartbeat_interval();
+        if (redundant_copies > 0) {
+            due = std::min(due, next_redundant_send);
+        }
+        int timeout = due > now ? (due - now + 999) / 1000 : 0;
 
-        if (polls[0].revents & (POLLIN | POLLERR)) {  // Message from server.
-            sockaddr_storage addr;
-            socklen_t addr_len = sizeof(sockaddr_storage);
-            Codec c(MAX_DATAGRAM_LEN);
-            ssize_t dglen = recvfrom(polls[0].fd, c.get_data(), MAX_DATAGRAM_LEN, 0, (sockaddr *)&addr, &addr_len);
-
-            if (dglen == -1) {
-                if (errno == 111) {
-                    std::cout << "connection with server lost\n";
-                    exit(EXIT_FAILURE);
-                } else
-                    std::cout << "Read error\n";
-            } else {
-                process_message_from_server(c, dglen);
-            }
+        int ret;
+        {
+            TRACE_SCOPE("poll");
+            ret = poll(polls, 3, timeout);
+        }
+        TRACE_POLL();
+        if (ret < 0) continue;
 
+        if (polls[0].revents & (POLLIN | POLLERR)) {  // Message from server.
+            receive_from_server(polls[0].fd);
             polls[0].revents &= ~(POLLIN | POLLERR);
         }
-        if ((write_to_server && (polls[0].revents & POLLOUT)) ||
-            get_timestamp() - last_client_info_send >= TO_SERVER_TICK) {  // Message to server.
-            if (get_timestamp() - last_client_info_send >= TO_SERVER_TICK) {
-                last_client_info_send = get_timestamp();
+        if (polls[2].revents & (POLLIN | POLLERR)) {  // Message from server through the multicast group.
+            receive_from_server(polls[2].fd);
+            polls[2].revents &= ~(POLLIN | POLLERR);
+        }
+        now = get_timestamp();
+        bool redundant = redundant_copies > 0 && now >= next_redundant_send;
+        bool heartbeat = now - last_client_info_send >= heartbeat_interval();
+        if ((write_to_server && (polls[0].revents & POLLOUT)) || heartbeat || redundant) {  // Message to server.
+            TRACE_SCOPE("send");
+            if (heartbeat) {
+                last_client_info_send = now;
+            }
+            if (redundant) {
+                redundant_copies--;
+                next_redundant_send = now + TURN_REDUNDANT_USEC;
             }
             Codec c;
             c.add_uint64_t(session_id);
             c.add_uint8_t(turn_direction);
             c.add_uint32_t(next_expected_event_no);
             c.add_string(player_name, false);
+            if (max_datagram_len != MAX_DATAGRAM_SIZE || multicast_fd != -1 || realtime_updates) {
+                // Asks the server for bigger datagrams, multicast or realtime updates, servers that do not know it
+                // reject the message.
+                c.add_uint8_t(0);
+                c.add_uint32_t(max_datagram_len);
+                uint8_t flags = multicast_fd != -1 ? MULTICAST_SUBSCRIBER : 0;
+                c.add_uint8_t(realtime_updates ? flags | REALTIME_UPDATES : flags);
+            }
             write_to_server = false;
+            acknowledged_event_no = next_expected_event_no;
+            event_gap = false;
 
             sendto(polls[0].fd, c.get_data(), c.get_len(), 0, (sockaddr *)server.addr(), server.len());
             polls[0].revents &= ~POLLOUT;
         }
 
         if (polls[1].revents & POLLIN) {  // Message from gui.
+            TRACE_SCOPE("gui_receive");
             char bufor[500];
             ssize_t len = recv(polls[1].fd, bufor, 500, 0);
 
@@ -183,6 +285,7 @@ void Client::run() {
                 exit(1);
             }
 
+            int8_t previous_turn_direction = turn_direction;
             for (int i = 0; i < len; ++i) {
                 if (bufor[i] == '\n') {
                     if (gui_message == "RIGHT_KEY_DOWN")
@@ -196,10 +299,17 @@ void Client::run() {
                 } else if (bufor[i] != '\0' && gui_message.length() < 30)
                     gui_message += bufor[i];
             }
+            /* A turn goes out at once instead of with the next heartbeat, followed by a few copies. */
+            if (turn_direction != previous_turn_direction) {
+                write_to_server = true;
+                redundant_copies = TURN_REDUNDANT_COPIES;
+                next_redundant_send = get_timestamp() + TURN_REDUNDANT_USEC;
+            }
 
             polls[1].revents &= ~(POLLIN | POLLERR);
         }
         if (write_to_gui || !gui_commands.empty()) {  // Message to gui.
+            TRACE_SCOPE("gui_send");
             size_t len = send(polls[1].fd, gui_commands.front().c_str(), gui_commands.front().length(), 0);
             write_to_gui = false;
             if (len == 0) {
@@ -220,7 +330,39 @@ void Client::run() {
     }
 }
 
+void Client::receive_from_server(int fd) {
+    TRACE_SCOPE("receive");
+    sockaddr_storage addr;
+    socklen_t addr_len = sizeof(sockaddr_storage);
+    Codec c(max_datagram_len);
+    ssize_t dglen = recvfrom(fd, c.get_data(), max_datagram_len, 0, (sockaddr *)&addr, &addr_len);
+
+    if (dglen == -1) {
+        if (errno == 111) {
+            std::cout << "connection with server lost\n";
+            exit(EXIT_FAILURE);
+        } else if (errno != EWOULDBLOCK && errno != EAGAIN)
+            std::cout << "Read error\n";
+    } else {
+        process_message_from_server(c, dglen);
+    }
+}
+
+/* Heartbeats go every TO_SERVER_TICK while they carry news: a turn, a gap in the events, or events the server has
+ * not seen acknowledged. The last matters outside multicast, as the server resends every event after the last
+ * acknowledged one on each tick, and answers a client it has not verified yet only on its heartbeats. A batched
+ * observer's events are assumed delivered by the server, so only the first acknowledgement of a game is news to
+ * it, the one that verifies a joining observer. Otherwise the client idles at a fraction of the server's timeout,
+ * which also acknowledges the tail of a game whose last datagram was lost. */
+uint64_t Client::heartbeat_interval() const {
+    bool assumed_delivered = player_name.empty() && !realtime_updates && acknowledged_event_no != 0;
+    bool news = turn_direction != 0 || redundant_copies > 0 || event_gap ||
+                (multicast_fd == -1 && !assumed_delivered && next_expected_event_no != acknowledged_event_no);
+    return news ? TO_SERVER_TICK : IDLE_HEARTBEAT_USEC;
+}
+
 void Client::process_message_from_server(Codec &c, ssize_t dglen) {
+    TRACE_SCOPE("parse");
     c.trim(dglen);
     uint32_t server_game_id = c.read_uint32_t();
     bool no_crc_error;
@@ -250,6 +392,7 @@ void Client::process_message_from_server(Codec &c, ssize_t dglen) {
                     // pass;
                 }
             } else {
+                event_gap = event_gap || event_no > next_expected_event_no;
                 c.skip_pos(len - 5);
             }
             c.read_uint32_t();
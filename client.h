@@ -3,6 +3,7 @@
 
 #include "codec.h"
 #include "connection.h"
+#include "protocol.h"
 #include "utility.h"
 
 #include <sys/time.h>
@@ -17,14 +18,17 @@
 
 #define DEFAULT_SERVER_PORT 2021
 #define DEFAULT_GUI_PORT 20210
+#define DEFAULT_MULTICAST_PORT 2022
 
-#define MAX_DATAGRAM_LEN 548
+#define RECEIVE_BUFFER_DATAGRAMS 64
 #define MIN_WIDTH 200
 #define MAX_WIDTH 1920
 #define MIN_HEIGHT 100
 #define MAX_HEIGHT 1080
 
-#define TO_SERVER_TICK 30000 // 30ms
+#define TURN_REDUNDANT_COPIES 2 // sent after the immediate one, so that a single lost datagram does not lose a turn
+#define TURN_REDUNDANT_USEC 5000
+#define IDLE_HEARTBEAT_USEC (INACTIVE_TIMEOUT_USEC / 4)
 
 
 class Client {
@@ -42,6 +46,8 @@ private:
     int8_t turn_direction = 0;
     std::string player_name;
     bool active_round = false;
+    uint32_t max_datagram_len = MAX_DATAGRAM_SIZE;
+    bool realtime_updates = false;
 
     bool write_to_server = false;
     bool write_to_gui = false;
@@ -50,20 +56,31 @@ private:
     Connection server;
     int gui_fd;
     Connection gui;
-    pollfd polls[2];
+    int multicast_fd = -1;
+    pollfd polls[3];
     uint64_t last_client_info_send;
+    uint32_t redundant_copies = 0;
+    uint64_t next_redundant_send = 0;
+    uint64_t acknowledged_event_no = 0;
+    bool event_gap = false;
     std::string gui_message;
 
     std::queue<Codec> server_messages;
     std::queue<std::string> gui_commands;
     std::vector<std::string> game_names;
 
+    void join_multicast(std::string const &group, uint32_t port);
+    uint64_t heartbeat_interval() const;
+    void receive_from_server(int fd);
     void process_message_from_server(Codec &c, ssize_t dglen);
 
     void new_game(Codec &c, uint32_t &event_no, uint32_t &len, uint32_t &server_game_id);
     void pixel(Codec &c, uint32_t &event_no);
     void player_eliminated(Codec &c, uint32_t &event_no);
     void game_over();
+
+    /* Drives the parser of screen-worms-bench without sockets. */
+    friend class ClientBench;
 };
 
 #endif // SIK2_CLIENT
\ No newline at end of file
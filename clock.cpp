@@ -0,0 +1,49 @@
+#include "clock.h"
+
+#include <ctime>
+
+Clock::~Clock() = default;
+
+uint64_t Clock::update() {
+    cached = read();
+    return cached;
+}
+
+uint64_t Clock::now() const {
+    return cached;
+}
+
+uint64_t Clock::wait(uint64_t usec) {
+    return usec;
+}
+
+uint64_t MonotonicClock::read() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * (uint64_t)1000000 + ts.tv_nsec / 1000;
+}
+
+uint64_t realtime_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return ts.tv_sec * (uint64_t)1000000000 + ts.tv_nsec;
+}
+
+VirtualClock::VirtualClock(uint64_t start) : time(start) {}
+
+uint64_t VirtualClock::read() {
+    return time;
+}
+
+uint64_t VirtualClock::wait(uint64_t usec) {
+    time += usec;
+    return 0;
+}
+
+void VirtualClock::advance(uint64_t usec) {
+    time += usec;
+}
+
+void VirtualClock::set(uint64_t usec) {
+    time = usec;
+}
@@ -0,0 +1,50 @@
+#ifndef SK2_CLOCK
+#define SK2_CLOCK
+
+#include <cstdint>
+
+/* Source of time for event loops, in microseconds. Loops call update() once per iteration and everything within
+ * the iteration uses now(), so the time source is read a few times per iteration instead of once per check. */
+class Clock {
+protected:
+    uint64_t cached = 0;
+
+public:
+    virtual ~Clock();
+
+    /* Reads the time source. */
+    virtual uint64_t read() = 0;
+    /* Returns how long a loop about to wait usec for input should block in real time. */
+    virtual uint64_t wait(uint64_t usec);
+
+    /* Reads the time source and caches the result. */
+    uint64_t update();
+    /* Returns the time cached by the last update(). */
+    uint64_t now() const;
+};
+
+/* CLOCK_MONOTONIC, which does not jump when the wall clock is adjusted and is shared by all processes. */
+class MonotonicClock : public Clock {
+public:
+    uint64_t read() override;
+};
+
+/* Clock that only moves when told to, for running timing logic faster than real time. A loop waiting on it does
+ * not block: the clock jumps to the end of the wait instead. */
+class VirtualClock : public Clock {
+private:
+    uint64_t time;
+
+public:
+    explicit VirtualClock(uint64_t start = 0);
+
+    uint64_t read() override;
+    uint64_t wait(uint64_t usec) override;
+    void advance(uint64_t usec);
+    void set(uint64_t usec);
+};
+
+/* CLOCK_REALTIME in nanoseconds, the clock of the kernel's receive timestamps. */
+uint64_t realtime_ns();
+
+#endif //SK2_CLOCK
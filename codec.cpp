@@ -13,9 +13,7 @@ void Codec::skip_pos(size_t skipped_pos) {
 }
 
 void Codec::add(void *data, size_t len) {
-    for (size_t i = 0; i < len; i++) {
-        this->data.push_back(((char *) data)[i]);
-    }
+    this->data.insert(this->data.end(), (char *) data, (char *) data + len);
 }
 
 void Codec::add_uint8_t(uint8_t val) {
@@ -23,6 +21,8 @@ void Codec::add_uint8_t(uint8_t val) {
 }
 
 uint8_t Codec::read_uint8_t() {
+    if (pos >= data.size())
+        throw CodecError("Invalid datagram\n");
     uint8_t val = *(uint8_t *)(data.data() + pos);
     pos++;
     return val;
@@ -99,10 +99,18 @@ void Codec::trim(size_t len) {
         data.resize(len);
 }
 
+void Codec::reserve(size_t len) {
+    data.reserve(len);
+}
+
 bool Codec::has_data() {
     return pos < data.size();
 }
 
+size_t Codec::get_remaining() {
+    return pos < data.size() ? data.size() - pos : 0;
+}
+
 size_t Codec::get_len() {
     return data.size();
 }
@@ -26,8 +26,11 @@ public:
     void skip_pos(size_t skipped_pos);
 
     bool has_data();
+    size_t get_remaining();
 
     void trim(size_t len);
+    /* Makes room for len bytes in all, so that adding them does not reallocate. */
+    void reserve(size_t len);
 
     void add_uint8_t(uint8_t);
     uint8_t read_uint8_t();
@@ -0,0 +1,197 @@
+#include "game.h"
+#include "alloc.h"
+#include "trace.h"
+#include "utility.h"
+
+void Game::set_settings(uint32_t maxx, uint32_t maxy, uint32_t turning_speed) {
+    this->maxx = maxx;
+    this->maxy = maxy;
+    this->turning_speed = turning_speed;
+}
+
+uint32_t Game::get_width() {
+    return maxx;
+}
+
+uint32_t Game::get_height() {
+    return maxy;
+}
+
+uint32_t Game::get_turning_speed() {
+    return turning_speed;
+}
+
+void Game::start(std::list<std::shared_ptr<Player> > &players) {
+    game_id = gen.next();
+
+    events.clear();
+    tick_starts.assign(1, 0);
+    used_pixels.clear();
+    active_players.clear();
+    players.sort([](const std::shared_ptr<Player> &p, const std::shared_ptr<Player> &p2) {
+        return p->get_name() < p2->get_name();
+    });
+
+    uint8_t player_id = 0;
+    for (auto &p : players) {
+        uint32_t new_x = gen.next() % maxx;
+        uint32_t new_y = gen.next() % maxy;
+        uint32_t new_rotation = gen.next() % 360;
+        p->set_new_position(new_x + 0.5, new_y + 0.5);
+        p->set_rotation(new_rotation);
+        p->set_game_id(player_id++);
+        active_players.push_back(p);
+    }
+    new_game(players);
+
+    for (auto &p : players) {
+        if (collision(*p)) {
+            player_eliminated(*p);
+        } else {
+            pixel(*p);
+        }
+    }
+
+    active = true;
+}
+
+void Game::tick(std::list<std::shared_ptr<Player> > &eliminated) {
+    TRACE_SCOPE("simulate");
+    ALLOC_SCOPE("simulate");
+    tick_starts.push_back(events.size());
+    for (auto itr = active_players.begin(); itr != active_players.end();) {
+        Player &p = **itr;
+        if (p.get_disconnected()) {
+            player_eliminated(p);
+            itr = active_players.erase(itr);
+            if (active_players.size() == WINNING_PLAYERS) {
+                game_over();
+                return;
+            }
+        } else if (p.move(turning_speed)) {
+            if (collision(p) || out_of_map(p)) {
+                player_eliminated(p);
+                eliminated.push_back(*itr);
+                itr = active_players.erase(itr);
+
+                if (active_players.size() == WINNING_PLAYERS) {
+                    game_over();
+                    return;
+                }
+            } else {
+                pixel(p);
+                itr++;
+            }
+        } else {
+            itr++;
+        }
+    }
+}
+
+/* Checks for collision of the player. Returns true on collision, false otherwise. */
+bool Game::collision(Player &p) {
+    std::pair<uint32_t, uint32_t> position{p.get_x(), p.get_y()};
+    return used_pixels.find(position) != used_pixels.end();
+}
+
+/* Checks whether player is out of the map. Returns true if player is out of the map, false otherwise */
+bool Game::out_of_map(Player &p) {
+    return floor(p.get_x()) >= maxx || floor(p.get_x()) < 0 || floor(p.get_y()) >= maxy || floor(p.get_y()) < 0;
+}
+
+void Game::new_game(std::list<std::shared_ptr<Player> > const &players) {
+    uint32_t len = 0;
+    for (auto &p : players) {
+        len += p->get_name().length() + 1;
+    }
+
+    auto event = std::make_shared<Codec>();
+    event->reserve(4 + 4 + 1 + 4 + 4 + len + 4);
+    event->add_uint32_t(4 + 1 + 4 + 4 + len);
+    event->add_uint32_t(events.size());
+    event->add_uint8_t(0);
+    event->add_uint32_t(maxx);
+    event->add_uint32_t(maxy);
+    for (auto &p : players) {
+        event->add_string(p->get_name(), true);
+    }
+    event->add_uint32_t(get_crc32(event->get_pos(), 4 + 4 + 1 + 4 + 4 + len));
+    events.push_back(event);
+}
+
+void Game::pixel(Player &p) {
+    auto event = std::make_shared<Codec>();
+    event->reserve(4 + 4 + 1 + 1 + 4 + 4 + 4);
+    event->add_uint32_t(4 + 1 + 1 + 4 + 4);  // len
+    event->add_uint32_t(events.size());
+    event->add_uint8_t(1);
+    event->add_uint8_t(p.get_game_id());
+    event->add_uint32_t(floor(p.get_x()));
+    event->add_uint32_t(floor(p.get_y()));
+    event->add_uint32_t(get_crc32(event->get_pos(), 4 + 4 + 1 + 1 + 4 + 4));
+
+    std::pair<uint32_t, uint32_t> position{floor(p.get_x()), floor(p.get_y())};
+    used_pixels.insert(position);
+
+    events.push_back(event);
+}
+
+void Game::player_eliminated(Player &p) {
+    auto event = std::make_shared<Codec>();
+    event->reserve(4 + 4 + 1 + 1 + 4);
+    event->add_uint32_t(4 + 1 + 1);  // len
+    event->add_uint32_t(events.size());
+    event->add_uint8_t(2);
+    event->add_uint8_t(p.get_game_id());
+    event->add_uint32_t(get_crc32(event->get_pos(), 4 + 4 + 1 + 1));
+
+    events.push_back(event);
+}
+
+void Game::game_over() {
+    auto event = std::make_shared<Codec>();
+    event->reserve(4 + 4 + 1 + 4);
+    event->add_uint32_t(4 + 1);  // len
+    event->add_uint32_t(events.size());
+    event->add_uint8_t(3);
+    event->add_uint32_t(get_crc32(event->get_pos(), 4 + 4 + 1));
+
+    active = false;
+    events.push_back(event);
+}
+
+bool Game::is_active() {
+    return active;
+}
+
+void Game::set_active(bool active) {
+    this->active = active;
+}
+
+uint32_t Game::get_game_id() {
+    return game_id;
+}
+
+void Game::set_game_id(uint32_t game_id) {
+    this->game_id = game_id;
+}
+
+Generator &Game::get_generator() {
+    return gen;
+}
+
+std::vector<std::shared_ptr<Codec> > &Game::get_events() {
+    return events;
+}
+
+std::list<std::shared_ptr<Player> > &Game::get_active_players() {
+    return active_players;
+}
+
+std::set<std::pair<uint32_t, uint32_t> > &Game::get_used_pixels() {
+    return used_pixels;
+}
+
+std::vector<uint32_t> &Game::get_tick_starts() {
+    return tick_starts;
+}
@@ -0,0 +1,66 @@
+#ifndef SK2_GAME
+#define SK2_GAME
+
+#include "codec.h"
+#include "generator.h"
+#include "player.h"
+
+#include <list>
+#include <memory>
+#include <set>
+#include <vector>
+
+#define WINNING_PLAYERS 1
+
+/* Rules of the game, without any networking: positions players, moves them every tick, detects collisions and
+ * records everything that happens as events in the wire format. Used by the server and by the simulator. */
+class Game {
+private:
+    uint32_t maxx = 0, maxy = 0;
+    uint32_t turning_speed = 0;
+    uint32_t game_id = 0;
+    bool active = false;
+    Generator gen;
+    std::set<std::pair<uint32_t, uint32_t> > used_pixels;
+    std::list<std::shared_ptr<Player> > active_players;
+    std::vector<std::shared_ptr<Codec> > events;
+    std::vector<uint32_t> tick_starts;
+
+    void new_game(std::list<std::shared_ptr<Player> > const &players);
+    void pixel(Player &p);
+    void player_eliminated(Player &p);
+    void game_over();
+    bool out_of_map(Player &p);
+    bool collision(Player &p);
+
+public:
+    void set_settings(uint32_t maxx, uint32_t maxy, uint32_t turning_speed);
+    uint32_t get_width();
+    uint32_t get_height();
+    uint32_t get_turning_speed();
+
+    /* Starts a new game with players, who are sorted by name and placed on the board. The event log is replaced
+     * by the new game's. */
+    void start(std::list<std::shared_ptr<Player> > &players);
+
+    /* Moves every active player one step. Players eliminated by a collision are appended to eliminated, they
+     * go back to the lobby; disconnected players are eliminated and dropped. */
+    void tick(std::list<std::shared_ptr<Player> > &eliminated);
+
+    bool is_active();
+    void set_active(bool active);
+    uint32_t get_game_id();
+    void set_game_id(uint32_t game_id);
+
+    Generator &get_generator();
+    std::vector<std::shared_ptr<Codec> > &get_events();
+    std::list<std::shared_ptr<Player> > &get_active_players();
+    std::set<std::pair<uint32_t, uint32_t> > &get_used_pixels();
+    /* Number of the first event of every tick of the game, tick 0 being its start. */
+    std::vector<uint32_t> &get_tick_starts();
+
+    /* Times the event emission in screen-worms-bench. */
+    friend class GameBench;
+};
+
+#endif //SK2_GAME
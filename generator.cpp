@@ -6,6 +6,11 @@ void Generator::set_seed(uint64_t seed) {
     r = seed;
 }
 
+/* Returns the value that the generator would have to be seeded with to continue from here. */
+uint64_t Generator::get_state() {
+    return r;
+}
+
 /* Returns next value from the generator */
 uint32_t Generator::next() {
     auto old_r = r;
@@ -12,6 +12,7 @@ public:
     Generator();
 
     void set_seed(uint64_t seed);
+    uint64_t get_state();
     uint32_t next();
 };
 
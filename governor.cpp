@@ -0,0 +1,58 @@
+#include "governor.h"
+
+#include <iostream>
+
+void Governor::set_budget(uint64_t usec) {
+    budget_usec = usec;
+}
+
+void Governor::add(Phase phase, uint64_t usec) {
+    phase_usec[phase] += usec;
+}
+
+void Governor::end_tick() {
+    uint64_t tick_usec = 0;
+    for (auto &usec : phase_usec) {
+        tick_usec += usec;
+    }
+
+    average_usec = (average_usec * 7 + tick_usec) / 8;
+
+    if (average_usec * 10 > budget_usec * 8) {
+        under_ticks = 0;
+        if (++over_ticks >= GOVERNOR_WINDOW) {
+            over_ticks = 0;
+            if (level < GOVERNOR_MAX_LEVEL) {
+                level++;
+            } else if (!reported) {
+                reported = true;
+                std::cerr << "Game speed of " << 1000 * 1000 / budget_usec
+                          << " rounds per second cannot be sustained: ticks take " << average_usec << "us (ingress "
+                          << phase_usec[INGRESS] << "us, tick " << phase_usec[TICK] << "us, fan-out "
+                          << phase_usec[FANOUT] << "us) of " << budget_usec << "us budget\n";
+            }
+        }
+    } else if (average_usec * 10 < budget_usec * 4) {
+        over_ticks = 0;
+        if (level > 0 && ++under_ticks >= GOVERNOR_RECOVERY) {
+            under_ticks = 0;
+            level--;
+            reported = false;
+        }
+    } else {
+        over_ticks = 0;
+        under_ticks = 0;
+    }
+
+    for (auto &usec : phase_usec) {
+        usec = 0;
+    }
+}
+
+bool Governor::postpone_observers() const {
+    return level >= 1;
+}
+
+uint32_t Governor::observer_stride() const {
+    return level >= 2 ? 1u << (level - 1) : 1;
+}
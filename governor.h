@@ -0,0 +1,43 @@
+#ifndef SK2_GOVERNOR
+#define SK2_GOVERNOR
+
+#include <cstdint>
+
+#define GOVERNOR_WINDOW 10 // ticks over budget before degrading further
+#define GOVERNOR_RECOVERY 50 // ticks well under budget before recovering one level
+#define GOVERNOR_MAX_LEVEL 4 // postponed catch-up, then observer stride 2, 4 and 8
+
+/* Keeps the game ticking at the configured rate when the server cannot keep up. The time spent in each phase
+ * of the loop is measured, and while a tick costs more than the budget the server degrades in order:
+ *  1. observers' catch-up is postponed to the slack before the next tick,
+ *  2. observers get updates every 2nd, 4th, then 8th tick,
+ *  3. the rate is reported as unsustainable.
+ * Players are never slowed down by the governor. */
+class Governor {
+public:
+    enum Phase { INGRESS, TICK, FANOUT, PHASES };
+
+private:
+    uint64_t budget_usec = 0;
+    uint64_t phase_usec[PHASES] = {};
+    uint64_t average_usec = 0;
+    uint32_t level = 0;
+    uint32_t over_ticks = 0;
+    uint32_t under_ticks = 0;
+    bool reported = false;
+
+public:
+    void set_budget(uint64_t usec);
+
+    /* Accounts time spent in phase since the last tick. */
+    void add(Phase phase, uint64_t usec);
+
+    /* Closes the tick, adjusting the level to the average cost of recent ticks. */
+    void end_tick();
+
+    bool postpone_observers() const;
+    /* Observers are sent updates every observer_stride() ticks. */
+    uint32_t observer_stride() const;
+};
+
+#endif //SK2_GOVERNOR
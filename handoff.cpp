@@ -0,0 +1,135 @@
+#include "handoff.h"
+
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+static bool make_address(std::string const &path, sockaddr_un &address) {
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if (path.length() >= sizeof(address.sun_path)) {
+        return false;
+    }
+    strcpy(address.sun_path, path.c_str());
+    return true;
+}
+
+int listen_handoff(std::string const &path) {
+    sockaddr_un address;
+    if (!make_address(path, address)) {
+        return -1;
+    }
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        return -1;
+    }
+    unlink(path.c_str());
+    if (bind(fd, (sockaddr *)&address, sizeof(address)) == -1 || listen(fd, 1) == -1) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+bool send_handoff(int conn, int fd, Codec &image, int timeout_msec) {
+    /* The image length travels with the descriptor, the image follows on the stream. */
+    uint32_t len = htobe32(image.get_len());
+    iovec iov;
+    iov.iov_base = &len;
+    iov.iov_len = sizeof(len);
+
+    char control[CMSG_SPACE(sizeof(int))];
+    memset(control, 0, sizeof(control));
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+    cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+    cm->cmsg_level = SOL_SOCKET;
+    cm->cmsg_type = SCM_RIGHTS;
+    cm->cmsg_len = CMSG_LEN(sizeof(int));
+    memcpy(CMSG_DATA(cm), &fd, sizeof(int));
+
+    if (sendmsg(conn, &msg, MSG_NOSIGNAL) != sizeof(len)) {
+        return false;
+    }
+    for (size_t sent = 0; sent < image.get_len();) {
+        ssize_t n = send(conn, image.get_data() + sent, image.get_len() - sent, MSG_NOSIGNAL);
+        if (n <= 0) {
+            return false;
+        }
+        sent += n;
+    }
+
+    pollfd pfd;
+    pfd.fd = conn;
+    pfd.events = POLLIN;
+    char ack = 0;
+    if (poll(&pfd, 1, timeout_msec) != 1 || read(conn, &ack, 1) != 1 || ack != 1) {
+        return false;
+    }
+    char go = 1;
+    return send(conn, &go, 1, MSG_NOSIGNAL) == 1;
+}
+
+int receive_handoff(std::string const &path, Codec &image, int &conn) {
+    sockaddr_un address;
+    if (!make_address(path, address)) {
+        return -1;
+    }
+    conn = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+    if (conn == -1) {
+        return -1;
+    }
+    if (connect(conn, (sockaddr *)&address, sizeof(address)) == -1) {
+        close(conn);
+        return -1;
+    }
+
+    uint32_t len;
+    iovec iov;
+    iov.iov_base = &len;
+    iov.iov_len = sizeof(len);
+    char control[CMSG_SPACE(sizeof(int))];
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+    msg.msg_control = control;
+    msg.msg_controllen = sizeof(control);
+
+    int fd = -1;
+    if (recvmsg(conn, &msg, MSG_WAITALL | MSG_CMSG_CLOEXEC) == sizeof(len)) {
+        cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        if (cm != nullptr && cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_RIGHTS) {
+            memcpy(&fd, CMSG_DATA(cm), sizeof(int));
+        }
+    }
+    if (fd == -1) {
+        close(conn);
+        return -1;
+    }
+
+    image = Codec(be32toh(len));
+    for (size_t received = 0; received < image.get_len();) {
+        ssize_t n = read(conn, image.get_data() + received, image.get_len() - received);
+        if (n <= 0) {
+            close(fd);
+            close(conn);
+            return -1;
+        }
+        received += n;
+    }
+    return fd;
+}
+
+bool ack_handoff(int conn) {
+    char ack = 1, go = 0;
+    bool taken = send(conn, &ack, 1, MSG_NOSIGNAL) == 1 && read(conn, &go, 1) == 1 && go == 1;
+    close(conn);
+    return taken;
+}
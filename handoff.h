@@ -0,0 +1,30 @@
+#ifndef SK2_HANDOFF
+#define SK2_HANDOFF
+
+#include "codec.h"
+
+#include <string>
+
+#define HANDOFF_MAGIC 0x53574834 // "SWH4", times on CLOCK_MONOTONIC, tick starts and queued datagrams
+
+/* Handing a running server over to a new process. The old server listens on a UNIX socket; the new one connects,
+ * gets the UDP socket (SCM_RIGHTS) together with an image of the game state, and says when it is ready to run.
+ * The old server then either tells it to go on and exits, or gives up and closes the connection, which makes the
+ * new one exit; so a failed or slow start of the new binary leaves the old one running, and never both. */
+
+/* Returns a non-blocking listening socket at path, replacing a stale one, or -1. */
+int listen_handoff(std::string const &path);
+
+/* Sends fd and image over conn and waits at most timeout_msec for the peer to be ready. Returns true if the peer
+ * was told to take over. */
+bool send_handoff(int conn, int fd, Codec &image, int timeout_msec);
+
+/* Connects to the server listening at path and receives its socket, returned, and state image. conn is left
+ * open for ack_handoff(). Returns -1 on failure. */
+int receive_handoff(std::string const &path, Codec &image, int &conn);
+
+/* Tells the old server that this process is ready and waits for it to hand over, then closes conn. Returns false
+ * if the old server gave up. */
+bool ack_handoff(int conn);
+
+#endif //SK2_HANDOFF
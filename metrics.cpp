@@ -0,0 +1,94 @@
+#include "metrics.h"
+
+#include <cstring>
+#include <fcntl.h>
+#include <new>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+char const *const METRICS_COUNTER_NAMES[COUNTERS][2] = {
+    {"ticks", "Game ticks run."},
+    {"late_ticks", "Game ticks started more than a millisecond after their deadline."},
+    {"datagrams_in", "Datagrams received."},
+    {"bytes_in", "Bytes received."},
+    {"datagrams_out", "Datagrams sent."},
+    {"bytes_out", "Bytes sent."},
+};
+
+char const *const METRICS_GAUGE_NAMES[GAUGES][2] = {
+    {"send_queue", "Datagrams queued for sending after the last tick."},
+    {"clients", "Connected clients."},
+    {"observers", "Connected clients not playing in the current game."},
+    {"events", "Events in the log of the current game."},
+    {"collision_pixels", "Pixels in the collision map."},
+    {"collision_bytes", "Estimated memory used by the collision map."},
+};
+
+char const *const METRICS_HISTOGRAM_NAMES[HISTOGRAMS][2] = {
+    {"ingress", "Time spent reading and handling client datagrams per loop iteration."},
+    {"simulate", "Time spent moving worms and checking collisions per tick."},
+    {"pack", "Time spent packing events for clients per tick."},
+    {"fanout", "Time spent handing datagrams to the kernel per loop iteration."},
+    {"tick", "Time spent on a whole tick."},
+    {"receive_queue", "Time client datagrams waited in the socket between arriving and being handled."},
+    {"input_age", "Time a turn change waited between arriving and being applied by a tick."},
+};
+
+Metrics::Metrics() : segment(&local) {
+    memset((void *)&local, 0, sizeof(local));
+    local.magic = METRICS_MAGIC;
+    local.pid = getpid();
+}
+
+bool Metrics::share(std::string const &name) {
+    int fd = shm_open(name.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd == -1) {
+        return false;
+    }
+    void *mapped = MAP_FAILED;
+    if (ftruncate(fd, sizeof(MetricsSegment)) == 0) {
+        mapped = mmap(nullptr, sizeof(MetricsSegment), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    }
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return false;
+    }
+
+    segment = (MetricsSegment *)mapped;
+    memcpy((void *)segment, (void *)&local, sizeof(local));
+    return true;
+}
+
+void Metrics::observe(MetricsHistogram histogram, uint64_t usec) {
+    MetricsHistogramData &h = segment->histograms[histogram];
+    size_t bucket = usec == 0 ? 0 : 64 - __builtin_clzll(usec);
+    if (bucket >= METRICS_BUCKETS) {
+        bucket = METRICS_BUCKETS - 1;
+    }
+    h.buckets[bucket].store(h.buckets[bucket].load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+    h.sum.store(h.sum.load(std::memory_order_relaxed) + usec, std::memory_order_relaxed);
+    h.count.store(h.count.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+}
+
+MetricsSegment const *open_metrics(std::string const &name) {
+    int fd = shm_open(name.c_str(), O_RDONLY | O_CLOEXEC, 0);
+    struct stat st;
+    if (fd == -1 || fstat(fd, &st) == -1 || st.st_size < (off_t)sizeof(MetricsSegment)) {
+        if (fd != -1) {
+            close(fd);
+        }
+        return nullptr;
+    }
+    void *mapped = mmap(nullptr, sizeof(MetricsSegment), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (mapped == MAP_FAILED) {
+        return nullptr;
+    }
+    MetricsSegment const *segment = (MetricsSegment const *)mapped;
+    if (segment->magic != METRICS_MAGIC) {
+        munmap(mapped, sizeof(MetricsSegment));
+        return nullptr;
+    }
+    return segment;
+}
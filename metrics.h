@@ -0,0 +1,80 @@
+#ifndef SK2_METRICS
+#define SK2_METRICS
+
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+#define METRICS_MAGIC 0x53574d32 // "SWM2"
+#define METRICS_BUCKETS 24 // bucket i counts durations below 2^i usec, the last one everything longer
+#define METRICS_LATE_USEC 1000 // ticks starting this much after their deadline are late
+
+static_assert(ATOMIC_LONG_LOCK_FREE == 2 && ATOMIC_LLONG_LOCK_FREE == 2,
+              "metrics are shared with other processes and need lock-free 64 bit atomics");
+
+enum MetricsCounter { TICKS, LATE_TICKS, DATAGRAMS_IN, BYTES_IN, DATAGRAMS_OUT, BYTES_OUT, COUNTERS };
+enum MetricsGauge { SEND_QUEUE, CLIENTS, OBSERVERS, EVENTS, COLLISION_PIXELS, COLLISION_BYTES, GAUGES };
+enum MetricsHistogram {
+    INGRESS_USEC,
+    SIMULATE_USEC,
+    PACK_USEC,
+    FANOUT_USEC,
+    TICK_USEC,
+    RECEIVE_QUEUE_USEC,
+    INPUT_AGE_USEC,
+    HISTOGRAMS
+};
+
+struct MetricsHistogramData {
+    std::atomic<uint64_t> buckets[METRICS_BUCKETS];
+    std::atomic<uint64_t> count;
+    std::atomic<uint64_t> sum;
+};
+
+/* Layout of the shared memory segment. Only the server writes to it; readers map it read-only and may see a
+ * histogram's count and buckets from slightly different moments. */
+struct MetricsSegment {
+    uint32_t magic;
+    uint32_t pid;
+    std::atomic<uint64_t> counters[COUNTERS];
+    std::atomic<uint64_t> gauges[GAUGES];
+    MetricsHistogramData histograms[HISTOGRAMS];
+};
+
+/* Names and descriptions of the metrics, in enum order. */
+extern char const *const METRICS_COUNTER_NAMES[COUNTERS][2];
+extern char const *const METRICS_GAUGE_NAMES[GAUGES][2];
+extern char const *const METRICS_HISTOGRAM_NAMES[HISTOGRAMS][2];
+
+/* Counters, gauges and histograms of the server's internals. They live in process memory until share() places
+ * them in a POSIX shared memory segment, where other processes can read them without the server noticing.
+ * Updates are plain relaxed loads and stores, as the server's single thread is the only writer. */
+class Metrics {
+private:
+    MetricsSegment local;
+    MetricsSegment *segment;
+
+public:
+    Metrics();
+
+    /* Moves the metrics to the shared memory segment called name ("/screen-worms"). Returns false if it could not
+     * be created. */
+    bool share(std::string const &name);
+
+    void add(MetricsCounter counter, uint64_t n = 1) {
+        std::atomic<uint64_t> &c = segment->counters[counter];
+        c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+    }
+
+    void set(MetricsGauge gauge, uint64_t value) {
+        segment->gauges[gauge].store(value, std::memory_order_relaxed);
+    }
+
+    void observe(MetricsHistogram histogram, uint64_t usec);
+};
+
+/* Maps the shared memory segment called name read-only. Returns nullptr if it does not exist or is not a metrics
+ * segment. */
+MetricsSegment const *open_metrics(std::string const &name);
+
+#endif //SK2_METRICS
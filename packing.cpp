@@ -0,0 +1,60 @@
+#include "packing.h"
+
+/* Packs as many events as fit in max_size, starting from next_event_no, into one datagram. The events are
+ * measured first, so that the datagram is allocated once. */
+std::shared_ptr<Codec> pack_events(std::vector<std::shared_ptr<Codec> > const &events, uint32_t game_id,
+                                   uint32_t &next_event_no, uint32_t max_size) {
+    size_t len = 4;
+    uint32_t end = next_event_no;
+    while (end < events.size() && len + events[end]->get_len() <= max_size) {
+        len += events[end++]->get_len();
+    }
+
+    auto datagram = std::make_shared<Codec>();
+    datagram->reserve(len);
+    datagram->add_uint32_t(game_id);
+    for (; next_event_no < end; next_event_no++) {
+        datagram->add(events[next_event_no]->get_pos(), events[next_event_no]->get_len());
+    }
+    return datagram;
+}
+
+/* Packs every event the player has not seen yet into datagrams of the player's size. With GSO, runs of equally
+ * sized datagrams are joined into one buffer so that a catch-up burst costs a single send. */
+void pack_events_for_player(std::vector<std::shared_ptr<Codec> > const &events, uint32_t game_id,
+                            std::shared_ptr<Player> const &p, bool gso, std::queue<OutgoingDatagram> &out) {
+    uint32_t client_next_expected_no = p->get_next_expected_event_no();
+    OutgoingDatagram burst{p, nullptr, 0};
+    size_t segments = 0;
+    while (client_next_expected_no < events.size()) {
+        auto event = pack_events(events, game_id, client_next_expected_no, p->get_max_datagram_size());
+
+        if (gso && burst.data && segments < GSO_MAX_SEGMENTS && event->get_len() <= burst.segment_size &&
+            burst.data->get_len() + event->get_len() <= GSO_MAX_BYTES) {
+            burst.data->add(event->get_data(), event->get_len());
+            segments++;
+            if (event->get_len() == burst.segment_size) {
+                continue;
+            }
+            // A shorter datagram can only be the last segment.
+            event = nullptr;
+        }
+
+        if (burst.data) {
+            if (segments == 1) {
+                burst.segment_size = 0;
+            }
+            out.push(burst);
+        }
+        burst.data = event;
+        burst.segment_size = event ? event->get_len() : 0;
+        segments = event ? 1 : 0;
+    }
+
+    if (burst.data) {
+        if (segments == 1) {
+            burst.segment_size = 0;
+        }
+        out.push(burst);
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef SK2_PACKING
+#define SK2_PACKING
+
+#include "codec.h"
+#include "player.h"
+
+#include <memory>
+#include <queue>
+#include <vector>
+
+#define GSO_MAX_SEGMENTS 64
+#define GSO_MAX_BYTES 65507
+
+/* Datagram waiting to be sent. With segment_size set, data holds consecutive datagrams of that size (the last
+ * one may be shorter) which are handed to the kernel in a single UDP_SEGMENT send. sent counts the bytes of data
+ * that went out before a full socket cut the send short. */
+struct OutgoingDatagram {
+    std::shared_ptr<Player> player;
+    std::shared_ptr<Codec> data;
+    uint16_t segment_size;
+    uint32_t sent;
+};
+
+std::shared_ptr<Codec> pack_events(std::vector<std::shared_ptr<Codec> > const &events, uint32_t game_id,
+                                   uint32_t &next_event_no, uint32_t max_size);
+
+void pack_events_for_player(std::vector<std::shared_ptr<Codec> > const &events, uint32_t game_id,
+                            std::shared_ptr<Player> const &p, bool gso, std::queue<OutgoingDatagram> &out);
+
+#endif //SK2_PACKING
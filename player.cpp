@@ -1,5 +1,8 @@
 #include "player.h"
 
+#include <cstring>
+#include <unistd.h>
+
 Player::Player(const Connection &conn, const std::string &player_name, uint64_t session_id,
                uint32_t next_expected_event_no, int32_t turn_direction)
     : conn(conn),
@@ -7,8 +10,19 @@ Player::Player(const Connection &conn, const std::string &player_name, uint64_t
       session_id(session_id),
       next_expected_event_no(next_expected_event_no),
       turn_direction(turn_direction) {
-    last_message_time = get_timestamp();
+    last_message_time = 0;
     disconnected = false;
+    fd = -1;
+    max_datagram_size = MAX_DATAGRAM_SIZE;
+    multicast = false;
+    verified = false;
+    verification_event_no = 0;
+    tier = TIER_REALTIME;
+    input_time = 0;
+}
+
+Player::~Player() {
+    close_socket();
 }
 
 const Connection &Player::get_connection_attr() { return conn; }
@@ -94,4 +108,128 @@ void Player::set_new_position(double x, double y) {
 
 void Player::set_rotation(uint32_t rotation) {
     this->rotation = rotation;
+}
+
+void Player::save(Codec &c) {
+    c.add_uint32_t(conn.len());
+    c.add((void *)conn.addr(), conn.len());
+    c.add_string(name, true);
+    c.add_uint64_t(session_id);
+    c.add_uint32_t(next_expected_event_no);
+    c.add_uint8_t(turn_direction);
+    uint64_t bits;
+    memcpy(&bits, &x, sizeof(bits));
+    c.add_uint64_t(bits);
+    memcpy(&bits, &y, sizeof(bits));
+    c.add_uint64_t(bits);
+    c.add_uint32_t(rotation);
+    c.add_uint64_t(last_message_time);
+    c.add_uint8_t(game_id);
+    c.add_uint32_t(max_datagram_size);
+    c.add_uint8_t(tier);
+    c.add_uint8_t(ready | disconnected << 1 | multicast << 2 | verified << 3);
+}
+
+std::shared_ptr<Player> Player::load(Codec &c) {
+    Connection conn;
+    uint32_t len = c.read_uint32_t();
+    if (len > sizeof(sockaddr_storage) || c.get_remaining() < len) {
+        throw CodecError("Invalid player\n");
+    }
+    memcpy(conn.addr(), c.get_pos(), len);
+    conn.len() = len;
+    c.skip_pos(len);
+
+    std::string name = c.read_string(true);
+    uint64_t session_id = c.read_uint64_t();
+    uint32_t next_expected_event_no = c.read_uint32_t();
+    int8_t turn_direction = c.read_uint8_t();
+    auto p = std::make_shared<Player>(conn, name, session_id, next_expected_event_no, turn_direction);
+
+    uint64_t bits = c.read_uint64_t();
+    memcpy(&p->x, &bits, sizeof(bits));
+    bits = c.read_uint64_t();
+    memcpy(&p->y, &bits, sizeof(bits));
+    p->rotation = c.read_uint32_t();
+    p->last_message_time = c.read_uint64_t();
+    p->game_id = c.read_uint8_t();
+    p->max_datagram_size = c.read_uint32_t();
+    p->tier = c.read_uint8_t();
+    uint8_t flags = c.read_uint8_t();
+    p->ready = flags & 1;
+    p->disconnected = flags & 2;
+    p->multicast = flags & 4;
+    p->verified = flags & 8;
+    return p;
+}
+
+/* Returns the datagram size agreed with the client. */
+uint32_t Player::get_max_datagram_size() {
+    return max_datagram_size;
+}
+
+void Player::set_max_datagram_size(uint32_t size) {
+    max_datagram_size = size;
+}
+
+/* Returns whether live events reach the client through the multicast group. */
+bool Player::get_multicast() {
+    return multicast;
+}
+
+void Player::set_multicast(bool multicast) {
+    this->multicast = multicast;
+}
+
+/* Returns whether the client has shown it receives what is sent to its address. */
+bool Player::get_verified() {
+    return verified;
+}
+
+void Player::set_verified(bool verified) {
+    this->verified = verified;
+}
+
+/* Returns the event after the last datagram sent to the client while it was not verified, which only a client
+ * that received the datagram can acknowledge. */
+uint32_t Player::get_verification_event_no() {
+    return verification_event_no;
+}
+
+void Player::set_verification_event_no(uint32_t event_no) {
+    verification_event_no = event_no;
+}
+
+/* Returns how often the client wants updates, TIER_REALTIME for every event, TIER_BATCHED every few ticks. */
+uint8_t Player::get_tier() {
+    return tier;
+}
+
+void Player::set_tier(uint8_t tier) {
+    this->tier = tier;
+}
+
+/* Returns when the turn change that no tick has applied yet arrived at the server, or 0 if there is none. */
+uint64_t Player::get_input_time() {
+    return input_time;
+}
+
+void Player::set_input_time(uint64_t input_time) {
+    this->input_time = input_time;
+}
+
+/* Returns the player's own connected socket, or -1 if the shared server socket is used. */
+int Player::get_socket() {
+    return fd;
+}
+
+void Player::set_socket(int fd) {
+    this->fd = fd;
+}
+
+void Player::close_socket() {
+    if (fd != -1) {
+        close(fd);
+        fd = -1;
+    }
 }
\ No newline at end of file
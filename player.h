@@ -1,13 +1,19 @@
 #ifndef SIK2_PLAYER
 #define SIK2_PLAYER
 
+#include "codec.h"
 #include "connection.h"
+#include "protocol.h"
 #include "utility.h"
 
 #include <cstdint>
 #include <cmath>
+#include <memory>
 #include <string>
 
+#define TIER_REALTIME 0
+#define TIER_BATCHED 1
+
 class Player {
 private:
     Connection conn;
@@ -21,9 +27,19 @@ private:
     uint64_t last_message_time;
     bool disconnected;
     int8_t game_id;
+    int fd;
+    uint32_t max_datagram_size;
+    bool multicast;
+    bool verified;
+    uint32_t verification_event_no;
+    uint8_t tier;
+    uint64_t input_time;
 public:
     Player(const Connection &c, const std::string &player_name,
            uint64_t session_id, uint32_t next_expected_event_no, int32_t turn_direction);
+    Player(const Player &) = delete;
+    Player &operator=(const Player &) = delete;
+    ~Player();
 
     const Connection &get_connection_attr();
 
@@ -55,6 +71,32 @@ public:
     void set_next_expected_event_no(uint32_t event_no);
 
     void set_rotation(uint32_t rotation);
+
+    /* Writes the state of the player, except its socket, for handing the game over to another process. */
+    void save(Codec &c);
+    /* Reads a player written with save(). Throws CodecError on a malformed image. */
+    static std::shared_ptr<Player> load(Codec &c);
+
+    uint32_t get_max_datagram_size();
+    void set_max_datagram_size(uint32_t size);
+
+    bool get_multicast();
+    void set_multicast(bool multicast);
+
+    bool get_verified();
+    void set_verified(bool verified);
+    uint32_t get_verification_event_no();
+    void set_verification_event_no(uint32_t event_no);
+
+    uint8_t get_tier();
+    void set_tier(uint8_t tier);
+
+    uint64_t get_input_time();
+    void set_input_time(uint64_t input_time);
+
+    int get_socket();
+    void set_socket(int fd);
+    void close_socket();
 };
 
 #endif //SIK2_PLAYER
\ No newline at end of file
@@ -0,0 +1,16 @@
+#ifndef SK2_PROTOCOL
+#define SK2_PROTOCOL
+
+/* Limits, flags and timing of the protocol, shared by the server, relays, clients and the tools. */
+
+#define MAX_DATAGRAM_SIZE 548 // default size of a server datagram, larger ones are asked for in the heartbeat
+#define MAX_UDP_PAYLOAD 65507
+
+/* Flags of the heartbeat extension. */
+#define MULTICAST_SUBSCRIBER 1
+#define REALTIME_UPDATES 2
+
+#define TO_SERVER_TICK 30000 // 30ms, between heartbeats of a client with something to tell
+#define INACTIVE_TIMEOUT_USEC (2 * 1000 * 1000) // after which the server disconnects a silent client
+
+#endif //SK2_PROTOCOL
@@ -0,0 +1,156 @@
+#include "reactor.h"
+#include "trace.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/socket.h>
+
+Reactor::~Reactor() = default;
+
+void Reactor::enable_gso() {
+    gso = true;
+}
+
+bool Reactor::gso_enabled() const {
+    return gso;
+}
+
+bool enable_receive_timestamps(int fd) {
+    int flag = 1;
+    return setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &flag, sizeof(flag)) == 0;
+}
+
+uint64_t receive_timestamp(msghdr const &msg) {
+    for (cmsghdr *cm = CMSG_FIRSTHDR(&msg); cm != nullptr; cm = CMSG_NXTHDR((msghdr *)&msg, cm)) {
+        if (cm->cmsg_level == SOL_SOCKET && cm->cmsg_type == SCM_TIMESTAMPNS) {
+            timespec ts;
+            memcpy(&ts, CMSG_DATA(cm), sizeof(ts));
+            return ts.tv_sec * (uint64_t)1000000000 + ts.tv_nsec;
+        }
+    }
+    return 0;
+}
+
+bool gso_unsupported(int err) {
+    return err == EINVAL || err == EOPNOTSUPP || err == ENOPROTOOPT || err == EIO;
+}
+
+PollReactor::PollReactor(size_t max_datagram) : max_datagram(max_datagram) {}
+
+void PollReactor::add_socket(int fd) {
+    pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN | POLLERR;
+    pfd.revents = 0;
+    polls.push_back(pfd);
+}
+
+void PollReactor::remove_socket(int fd) {
+    polls.erase(std::remove_if(polls.begin(), polls.end(), [fd](pollfd const &pfd) { return pfd.fd == fd; }),
+                polls.end());
+}
+
+/* Segmented bursts go out with UDP_SEGMENT; a burst that cannot be segmented on its way out is sent datagram by
+ * datagram instead. GSO stays on for the others, whose route may well support it. */
+bool PollReactor::send(int fd, Connection const *to, std::shared_ptr<Codec> const &data, uint16_t segment_size,
+                       uint32_t &sent) {
+    TRACE_SCOPE("send");
+    msghdr msg;
+    memset(&msg, 0, sizeof(msg));
+    if (to != nullptr) {
+        msg.msg_name = (void *)to->addr();
+        msg.msg_namelen = to->len();
+    }
+
+    iovec iov;
+    msg.msg_iov = &iov;
+    msg.msg_iovlen = 1;
+
+    if (segment_size != 0 && gso && sent == 0) {
+        char control[CMSG_SPACE(sizeof(uint16_t))];
+        memset(control, 0, sizeof(control));
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        cmsghdr *cm = CMSG_FIRSTHDR(&msg);
+        cm->cmsg_level = SOL_UDP;
+        cm->cmsg_type = UDP_SEGMENT;
+        cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        *(uint16_t *)CMSG_DATA(cm) = segment_size;
+
+        iov.iov_base = data->get_data();
+        iov.iov_len = data->get_len();
+        if (sendmsg(fd, &msg, 0) >= 0) {
+            return true;
+        }
+        if (errno == EWOULDBLOCK || errno == EAGAIN) {
+            return false;
+        }
+        if (!gso_unsupported(errno)) {
+            return true;
+        }
+        msg.msg_control = nullptr;
+        msg.msg_controllen = 0;
+    }
+
+    size_t segment = segment_size != 0 ? segment_size : data->get_len();
+    while (sent < data->get_len()) {
+        iov.iov_base = data->get_data() + sent;
+        iov.iov_len = std::min(segment, data->get_len() - sent);
+        if (sendmsg(fd, &msg, 0) < 0) {
+            return errno != EWOULDBLOCK && errno != EAGAIN;
+        }
+        sent += iov.iov_len;
+    }
+    return true;
+}
+
+void PollReactor::wait(uint64_t timeout_usec, bool want_write, std::vector<ReceivedDatagram> &received) {
+    for (auto &pfd : polls) {
+        pfd.revents = 0;
+    }
+    polls[0].events = want_write ? (POLLIN | POLLOUT) : POLLIN;
+
+    timespec timeout;
+    timeout.tv_sec = timeout_usec / 1000000;
+    timeout.tv_nsec = (timeout_usec % 1000000) * 1000;
+    int ready;
+    {
+        TRACE_SCOPE("poll");
+        ready = ppoll(polls.data(), polls.size(), &timeout, nullptr);
+    }
+    if (ready <= 0) {
+        return;
+    }
+
+    TRACE_SCOPE("receive");
+    char control[CMSG_SPACE(sizeof(timespec))];
+    for (auto &pfd : polls) {
+        if (!(pfd.revents & (POLLIN | POLLERR))) {
+            continue;
+        }
+        ReceivedDatagram datagram{pfd.fd, Connection(), Codec(max_datagram), 0, 0};
+        iovec iov{datagram.data.get_data(), max_datagram};
+        msghdr msg;
+        memset(&msg, 0, sizeof(msg));
+        msg.msg_name = datagram.from.addr();
+        msg.msg_namelen = *datagram.from.len_ptr();
+        msg.msg_iov = &iov;
+        msg.msg_iovlen = 1;
+        msg.msg_control = control;
+        msg.msg_controllen = sizeof(control);
+        datagram.len = recvmsg(pfd.fd, &msg, 0);
+        if (datagram.len == -1) {
+            if (errno != EWOULDBLOCK && errno != EAGAIN && errno != ECONNREFUSED) {
+                std::cout << "Read error\n";
+            }
+        } else {
+            *datagram.from.len_ptr() = msg.msg_namelen;
+            datagram.received_ns = receive_timestamp(msg);
+            received.push_back(std::move(datagram));
+        }
+    }
+}
@@ -0,0 +1,79 @@
+#ifndef SK2_REACTOR
+#define SK2_REACTOR
+
+#include "codec.h"
+#include "connection.h"
+
+#include <poll.h>
+#include <memory>
+#include <sys/socket.h>
+#include <vector>
+
+#define MAX_RECEIVED_DATAGRAM 128
+
+/* Datagram read from one of the watched sockets. received_ns is when the kernel received it (CLOCK_REALTIME), or
+ * 0 if the socket does not have receive timestamps on. */
+struct ReceivedDatagram {
+    int fd;
+    Connection from;
+    Codec data;
+    ssize_t len;
+    uint64_t received_ns;
+};
+
+/* Turns SO_TIMESTAMPNS on, so that reactors report when the kernel received each datagram on fd. Returns false if
+ * the kernel does not support it. */
+bool enable_receive_timestamps(int fd);
+
+/* Returns the SO_TIMESTAMPNS time of a received message in nanoseconds, or 0 if its control data has none. */
+uint64_t receive_timestamp(msghdr const &msg);
+
+/* Returns whether a UDP_SEGMENT send failed with err because the burst cannot be segmented on its way out, rather
+ * than because of its peer. Such a burst is sent again datagram by datagram. */
+bool gso_unsupported(int err);
+
+/* Event loop backend of the server: watches UDP sockets for incoming datagrams and sends outgoing ones. */
+class Reactor {
+protected:
+    bool gso = false;
+
+public:
+    virtual ~Reactor();
+
+    /* Turns UDP_SEGMENT sends on, for a kernel that knows the option. */
+    void enable_gso();
+    bool gso_enabled() const;
+
+    virtual void add_socket(int fd) = 0;
+    /* Stops watching socket, has to be called before the socket is closed. */
+    virtual void remove_socket(int fd) = 0;
+
+    /* Sends datagram on fd, to address 'to' unless the socket is connected. With segment_size set, data holds
+     * several datagrams to be sent with UDP_SEGMENT. sent is the number of bytes of data sent before. Returns
+     * false if the socket is full and the datagram should be sent again later; sent then tells where to resume.
+     * Datagrams the peer's socket or route refuses are dropped like lost ones. */
+    virtual bool send(int fd, Connection const *to, std::shared_ptr<Codec> const &data, uint16_t segment_size,
+                      uint32_t &sent) = 0;
+
+    /* Waits at most timeout_usec for datagrams, appending those that arrived to received. With want_write,
+     * also wakes up when the sockets can take more datagrams. */
+    virtual void wait(uint64_t timeout_usec, bool want_write, std::vector<ReceivedDatagram> &received) = 0;
+};
+
+/* Reactor built on ppoll and one recvfrom/sendmsg call per datagram. */
+class PollReactor : public Reactor {
+private:
+    std::vector<pollfd> polls;
+    size_t max_datagram;
+
+public:
+    explicit PollReactor(size_t max_datagram = MAX_RECEIVED_DATAGRAM);
+
+    void add_socket(int fd) override;
+    void remove_socket(int fd) override;
+    bool send(int fd, Connection const *to, std::shared_ptr<Codec> const &data, uint16_t segment_size,
+              uint32_t &sent) override;
+    void wait(uint64_t timeout_usec, bool want_write, std::vector<ReceivedDatagram> &received) override;
+};
+
+#endif //SK2_REACTOR
@@ -0,0 +1,85 @@
+#include "realtime.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <malloc.h>
+#include <sched.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+
+static void prefault_stack() {
+    volatile char stack[REALTIME_PREFAULT_STACK];
+    for (size_t i = 0; i < sizeof(stack); i += 4096) {
+        stack[i] = 0;
+    }
+}
+
+void enter_realtime(uint32_t cpu, bool fifo) {
+    cpu_set_t set;
+    CPU_ZERO(&set);
+    CPU_SET(cpu, &set);
+    if (sched_setaffinity(0, sizeof(set), &set) == -1) {
+        std::cerr << "couldn't pin to cpu " << cpu << ": " << strerror(errno) << "\n";
+    }
+
+    if (fifo) {
+        sched_param param;
+        memset(&param, 0, sizeof(param));
+        param.sched_priority = REALTIME_PRIORITY;
+        if (sched_setscheduler(0, SCHED_FIFO, &param) == -1) {
+            std::cerr << "couldn't switch to SCHED_FIFO: " << strerror(errno) << "\n";
+        }
+    }
+
+    if (mlockall(MCL_CURRENT | MCL_FUTURE) == -1) {
+        std::cerr << "couldn't lock memory: " << strerror(errno) << "\n";
+    }
+
+    /* Freed memory stays in the heap instead of going back to the kernel, so the block touched here serves the
+     * allocations of the game without faults. */
+    mallopt(M_TRIM_THRESHOLD, -1);
+    mallopt(M_MMAP_MAX, 0);
+    char *heap = (char *)malloc(REALTIME_PREFAULT_BYTES);
+    if (heap != nullptr) {
+        for (size_t i = 0; i < REALTIME_PREFAULT_BYTES; i += 4096) {
+            heap[i] = 0;
+        }
+        free(heap);
+    }
+    prefault_stack();
+}
+
+bool enable_busy_poll(int fd) {
+    int usec = REALTIME_BUSY_POLL_USEC;
+    return setsockopt(fd, SOL_SOCKET, SO_BUSY_POLL, &usec, sizeof(usec)) == 0;
+}
+
+JitterHistogram::JitterHistogram() : counts(JITTER_MAX_USEC + 1, 0) {}
+
+void JitterHistogram::record(uint64_t usec) {
+    counts[usec < JITTER_MAX_USEC ? usec : JITTER_MAX_USEC]++;
+    samples++;
+}
+
+uint64_t JitterHistogram::get_samples() const {
+    return samples;
+}
+
+uint64_t JitterHistogram::percentile(double fraction) const {
+    uint64_t rank = (uint64_t)(fraction * samples);
+    uint64_t seen = 0;
+    for (size_t usec = 0; usec < counts.size(); usec++) {
+        seen += counts[usec];
+        if (seen > rank) {
+            return usec;
+        }
+    }
+    return JITTER_MAX_USEC;
+}
+
+void JitterHistogram::reset() {
+    std::fill(counts.begin(), counts.end(), 0);
+    samples = 0;
+}
@@ -0,0 +1,38 @@
+#ifndef SK2_REALTIME
+#define SK2_REALTIME
+
+#include <cstdint>
+#include <vector>
+
+#define REALTIME_PRIORITY 50
+#define REALTIME_SPIN_USEC 200
+#define REALTIME_BUSY_POLL_USEC 50
+#define REALTIME_PREFAULT_BYTES (16 * 1024 * 1024)
+#define REALTIME_PREFAULT_STACK (256 * 1024)
+#define JITTER_MAX_USEC 10000
+
+/* Pins the calling thread to cpu, optionally switches it to SCHED_FIFO, locks all memory and pre-faults the heap
+ * and the stack, so that later allocations and calls do not page fault. Steps that need privileges the process
+ * does not have are skipped with a warning. */
+void enter_realtime(uint32_t cpu, bool fifo);
+
+/* Turns on SO_BUSY_POLL for fd. Returns false if the kernel refused. */
+bool enable_busy_poll(int fd);
+
+/* Histogram of wake-up latencies with one microsecond buckets; longer ones share the last bucket. */
+class JitterHistogram {
+private:
+    std::vector<uint64_t> counts;
+    uint64_t samples = 0;
+
+public:
+    JitterHistogram();
+
+    void record(uint64_t usec);
+    uint64_t get_samples() const;
+    /* Returns the latency below which the given fraction of samples are. */
+    uint64_t percentile(double fraction) const;
+    void reset();
+};
+
+#endif //SK2_REALTIME
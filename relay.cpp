@@ -0,0 +1,281 @@
+#include "relay.h"
+#include "trace.h"
+#include "utility.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fcntl.h>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+
+Relay::Relay(int argc, char *argv[]) {
+    /* Parsing arguments */
+    std::string server_name;
+    uint32_t server_port = DEFAULT_SERVER_PORT, port = DEFAULT_RELAY_PORT;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:l:d:D:")) != -1) {
+        uint32_t parsed;
+        if (optarg == NULL) {
+            std::cerr << "No argument given\n";
+            exit(EXIT_FAILURE);
+        }
+        try {
+            parsed = string_to_uint32_t(optarg);
+        } catch (UtilityError const &e) {
+            std::cerr << static_cast<char>(opt) << ": " << e.what() << " '" << optarg << "'\n";
+            exit(EXIT_FAILURE);
+        }
+        switch (opt) {
+            case 'p':
+                server_port = parsed;
+                break;
+            case 'l':
+                port = parsed;
+                break;
+            case 'd':
+                max_datagram_size = parsed;
+                break;
+            case 'D':
+                upstream_datagram_size = parsed;
+                break;
+            default:
+                std::cerr << "Usage " << argv[0] << " game_server [-p n] [-l n] [-d n] [-D n]\n";
+                exit(EXIT_FAILURE);
+                break;
+        }
+    }
+    if (optind < argc) {
+        while (optind < argc) server_name = argv[optind++];
+    } else {
+        std::cerr << "Usage " << argv[0] << " game_server [-p n] [-l n] [-d n] [-D n]\n";
+        exit(EXIT_FAILURE);
+    }
+
+    if (server_port > MAX_PORT || port > MAX_PORT) {
+        std::cerr << "Incorrect port number\n";
+        exit(EXIT_FAILURE);
+    }
+    if (max_datagram_size < MAX_DATAGRAM_SIZE || max_datagram_size > MAX_UDP_PAYLOAD ||
+        upstream_datagram_size < MAX_DATAGRAM_SIZE || upstream_datagram_size > MAX_UDP_PAYLOAD) {
+        std::cerr << "Datagram size should be in [" << MAX_DATAGRAM_SIZE << ", " << MAX_UDP_PAYLOAD << "] range\n";
+        exit(EXIT_FAILURE);
+    }
+
+    session_id = get_timestamp();
+
+    /* Upstream connection, the relay is an ordinary observer of the game server. */
+    struct addrinfo serverhints = {};
+    serverhints.ai_family = AF_UNSPEC;
+    serverhints.ai_socktype = SOCK_DGRAM;
+    upstream = Connection(server_name.c_str(), server_port, serverhints);
+
+    upstream_fd = -1;
+    for (addrinfo *p = upstream.info; p != NULL && upstream_fd == -1; p = p->ai_next) {
+        if ((upstream_fd = socket(p->ai_family, p->ai_socktype | SOCK_NONBLOCK, p->ai_protocol)) == -1) {
+            continue;
+        }
+        if (connect(upstream_fd, p->ai_addr, p->ai_addrlen) == -1) {
+            close(upstream_fd);
+            upstream_fd = -1;
+        }
+    }
+    if (upstream_fd == -1) {
+        std::cerr << "Couldn't connect to server\n";
+        exit(EXIT_FAILURE);
+    }
+
+    /* Downstream socket for observers. */
+    fd = socket(AF_INET6, SOCK_DGRAM, 0);
+    if (fd == -1) {
+        std::cout << "couldn't create socket\n";
+        exit(EXIT_FAILURE);
+    }
+
+    sockaddr_in6 ip;
+    memset(&ip, 0, sizeof(sockaddr_in6));
+    ip.sin6_family = AF_INET6;
+    ip.sin6_port = htobe16(port);
+    ip.sin6_addr = in6addr_any;
+
+    if (bind(fd, (sockaddr *)&ip, sizeof(ip)) < 0) {
+        std::cerr << "cannot bind on port " << port << ": " << strerror(errno) << "\n";
+        exit(EXIT_FAILURE);
+    }
+
+    reactor.reset(new PollReactor(std::max<size_t>(upstream_datagram_size, MAX_RECEIVED_DATAGRAM)));
+    reactor->add_socket(fd);
+    reactor->add_socket(upstream_fd);
+
+    int segment = 0;
+    socklen_t segment_len = sizeof(segment);
+    if (getsockopt(fd, SOL_UDP, UDP_SEGMENT, &segment, &segment_len) == 0) {
+        reactor->enable_gso();
+    }
+}
+
+void Relay::run() {
+    while (true) {
+        flush_events_to_send();
+
+        uint64_t now = clock.update();
+        uint64_t deadline =
+            std::min<uint64_t>(last_heartbeat + TO_SERVER_TICK, last_check_timestamp + INACTIVE_CHECK_USEC);
+        received.clear();
+        reactor->wait(deadline > now ? deadline - now : 0, !events_to_send.empty(), received);
+
+        now = clock.update();
+        TRACE_POLL();
+        if (now - last_heartbeat >= TO_SERVER_TICK) {
+            send_heartbeat();
+            last_heartbeat = now;
+        }
+
+        /* Check for inactive observers and disconnect them. */
+        if (now - last_check_timestamp >= INACTIVE_CHECK_USEC) {
+            for (auto itr = clients.begin(); itr != clients.end();) {
+                if (now - itr->second->get_last_message_time() > INACTIVE_TIMEOUT_USEC) {
+                    itr = clients.erase(itr);
+                } else {
+                    ++itr;
+                }
+            }
+            last_check_timestamp = now;
+        }
+
+        for (auto &datagram : received) {
+            if (datagram.fd == upstream_fd) {
+                process_message_from_server(datagram.data, datagram.len);
+            } else {
+                process_message_from_client(datagram.from, datagram.data, datagram.len);
+            }
+        }
+    }
+}
+
+/* Heartbeat of an observer: empty name, asking for the next event of the game being followed. The relay always
+ * asks for realtime updates, as its observers would otherwise wait for batches on top of the relay hop, and for
+ * the default datagram size every observer accepts unless -D asks for more. */
+void Relay::send_heartbeat() {
+    Codec c;
+    c.add_uint64_t(session_id);
+    c.add_uint8_t(0);
+    c.add_uint32_t(active_round ? events.size() : 0);
+    c.add_uint8_t(0);
+    c.add_uint32_t(upstream_datagram_size);
+    c.add_uint8_t(REALTIME_UPDATES);
+    send(upstream_fd, c.get_data(), c.get_len(), 0);
+}
+
+/* Appends events of the followed game to the log, as they are on the wire, and passes them on. */
+void Relay::process_message_from_server(Codec &c, ssize_t dglen) {
+    c.trim(dglen);
+    if (dglen < 4) {
+        return;
+    }
+    uint32_t server_game_id = c.read_uint32_t();
+    bool same_game = !events.empty() && server_game_id == game_id;
+    if (same_game && !active_round) {
+        // Leftovers of a finished game.
+        return;
+    }
+
+    size_t old_size = events.size();
+    bool new_game = false;
+    try {
+        while (c.has_data()) {
+            uint32_t len = c.read_uint32_t();
+            char *start = (char *)c.get_pos() - 4;
+            if (len < 5 || !check_crc32(start, len + 4, c.read_crc(len))) {
+                break;
+            }
+            uint32_t event_no = c.read_uint32_t();
+            uint8_t event_type = c.read_uint8_t();
+            c.skip_pos(len - 5);
+            c.read_uint32_t();
+
+            if (!same_game) {
+                if (event_type != 0 || event_no != 0) {
+                    // A game whose start was missed, ask the server for it from the beginning.
+                    active_round = false;
+                    break;
+                }
+                events.clear();
+                game_id = server_game_id;
+                active_round = true;
+                same_game = true;
+                new_game = true;
+                for (auto &client : clients) {
+                    client.second->set_next_expected_event_no(0);
+                }
+            } else if (event_no != events.size()) {
+                continue;
+            }
+
+            auto event = std::make_shared<Codec>();
+            event->add(start, len + 8);
+            events.push_back(event);
+            if (event_type == 3) {
+                active_round = false;
+            }
+        }
+    } catch (CodecError const &e) {
+        // Truncated datagram, keep the events read so far.
+    }
+
+    if (new_game || events.size() > old_size) {
+        for (auto &client : clients) {
+            send_message_to_player(client.second);
+        }
+    }
+}
+
+/* Heartbeats from observers, handled like the game server does. Names are ignored, everyone is an observer. */
+void Relay::process_message_from_client(Connection address, Codec &p, ssize_t dglen) {
+    p.trim(dglen);
+    if (dglen < 8 + 1 + 4) {
+        return;
+    }
+    uint64_t session_id = p.read_uint64_t();
+    uint8_t turn_direction = p.read_uint8_t();
+    uint32_t next_expected_event_no = p.read_uint32_t();
+    std::string player_name = p.read_string(true);
+    try {
+        validate_playername(player_name);
+    } catch (UtilityError const &e) {
+        return;
+    }
+    uint32_t datagram_size = MAX_DATAGRAM_SIZE;
+    if (p.get_remaining() >= 4) {
+        datagram_size = std::max<uint32_t>(MAX_DATAGRAM_SIZE, std::min(p.read_uint32_t(), max_datagram_size));
+    }
+
+    auto itr = clients.find(address);
+    if (itr != clients.end() && itr->second->get_session_id() == session_id) {
+        itr->second->set_next_expected_event_no(next_expected_event_no);
+        itr->second->update_last_message_time(clock.now());
+    } else if (itr == clients.end() || itr->second->get_session_id() < session_id) {
+        if (itr != clients.end()) {
+            clients.erase(itr);
+        }
+        auto player =
+            std::make_shared<Player>(address, player_name, session_id, next_expected_event_no, turn_direction);
+        player->update_last_message_time(clock.now());
+        player->set_max_datagram_size(datagram_size);
+        clients.insert(std::make_pair(address, player));
+        send_message_to_player(player);
+    }
+}
+
+void Relay::send_message_to_player(std::shared_ptr<Player> const &p) {
+    pack_events_for_player(events, game_id, p, reactor->gso_enabled(), events_to_send);
+}
+
+void Relay::flush_events_to_send() {
+    while (!events_to_send.empty()) {
+        OutgoingDatagram &d = events_to_send.front();
+        if (!reactor->send(fd, &d.player->get_connection_attr(), d.data, d.segment_size, d.sent)) {
+            break;
+        }
+        events_to_send.pop();
+    }
+}
@@ -0,0 +1,59 @@
+#ifndef SK2_RELAY
+#define SK2_RELAY
+
+#include "clock.h"
+#include "codec.h"
+#include "connection.h"
+#include "packing.h"
+#include "player.h"
+#include "protocol.h"
+#include "reactor.h"
+
+#include <map>
+#include <memory>
+#include <queue>
+#include <vector>
+
+#define DEFAULT_SERVER_PORT 2021
+#define DEFAULT_RELAY_PORT 2023
+
+#define MAX_PORT 65535
+
+#define INACTIVE_CHECK_USEC 50000
+
+/* Spectator relay: follows a game server (or another relay) as a single observer, keeps its own copy of the
+ * event log and serves any number of observers with the same protocol as the server. */
+class Relay {
+private:
+    int fd;
+    int upstream_fd;
+    Connection upstream;
+    std::unique_ptr<Reactor> reactor;
+    std::vector<ReceivedDatagram> received;
+    MonotonicClock clock;
+
+    uint64_t session_id;
+    uint32_t upstream_datagram_size = MAX_DATAGRAM_SIZE;
+    uint32_t max_datagram_size = MAX_DATAGRAM_SIZE;
+    uint64_t last_heartbeat = 0;
+    uint64_t last_check_timestamp = 0;
+
+    uint32_t game_id = 0;
+    bool active_round = false;
+    std::vector<std::shared_ptr<Codec> > events;
+
+    std::map<Connection, std::shared_ptr<Player> > clients;
+    std::queue<OutgoingDatagram> events_to_send;
+
+    void send_heartbeat();
+    void process_message_from_server(Codec &c, ssize_t dglen);
+    void process_message_from_client(Connection address, Codec &p, ssize_t dglen);
+    void send_message_to_player(std::shared_ptr<Player> const &p);
+    void flush_events_to_send();
+
+public:
+    Relay(int argc, char *argv[]);
+    void run();
+};
+
+#endif //SK2_RELAY
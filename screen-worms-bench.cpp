@@ -0,0 +1,682 @@
+#include "client.h"
+#include "clock.h"
+#include "game.h"
+#include "governor.h"
+#include "packing.h"
+#include "protocol.h"
+#include "utility.h"
+
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <fstream>
+#include <map>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <new>
+#include <sys/socket.h>
+
+#define BENCH_PACKETS 200000
+#define BENCH_GSO_SEGMENTS 64
+
+#define BENCH_CRC_OPS 200000
+#define BENCH_CODEC_OPS 500000
+#define BENCH_MOVE_OPS 5000000
+#define BENCH_BOARD_WIDTH 640
+#define BENCH_BOARD_HEIGHT 480
+#define BENCH_BOARD_PLAYERS 16
+#define BENCH_TURNING_SPEED 6
+#define BENCH_BOARD_TICKS 600
+#define BENCH_BOARD_ROUNDS 40
+#define BENCH_EVENTS 4000
+#define BENCH_CLIENTS 256
+#define BENCH_PACK_ROUNDS 100
+#define BENCH_CATCHUP_ROUNDS 4
+#define BENCH_CLIENT_DATAGRAMS 20000
+#define BENCH_STEADY_ROUNDS 10
+#define BENCH_STEADY_TICKS 600
+#define BENCH_GOVERNOR_TICK_USEC 20000 // 50 ticks per second
+#define BENCH_GOVERNOR_CYCLES 2000
+#define BENCH_GOVERNOR_MAX_TICKS 1000 // ticks a cycle's overload or recovery may take at most
+#define DEFAULT_BENCH_THRESHOLD 10 // percent slower than the baseline that counts as a regression
+
+/* Microbenchmarks of the hot paths of the server and the client, and of the UDP send paths. Every benchmark
+ * reports its time and heap allocations per operation; results can be written as a baseline and later runs
+ * compared against it, flagging benchmarks that got slower or allocate more. With -a the steady-state tick
+ * must also stay within a number of allocations per tick. */
+
+static uint64_t allocations = 0;
+
+void *operator new(size_t size) {
+    allocations++;
+    void *p = malloc(size == 0 ? 1 : size);
+    if (p == nullptr) {
+        throw std::bad_alloc();
+    }
+    return p;
+}
+
+void operator delete(void *p) noexcept {
+    free(p);
+}
+
+struct BenchResult {
+    double ns_per_op;
+    double allocs_per_op;
+};
+
+static std::map<std::string, BenchResult> results;
+static std::string filter;
+
+static uint64_t now_ns() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * (uint64_t)1000000000 + ts.tv_nsec;
+}
+
+static bool selected(char const *name) {
+    return std::string(name).find(filter) != std::string::npos;
+}
+
+/* Measures a part of a benchmark; parts of the same benchmark add up. */
+class Measurement {
+private:
+    uint64_t start_ns;
+    uint64_t start_allocs;
+
+public:
+    uint64_t ns = 0;
+    uint64_t allocs = 0;
+
+    void start() {
+        start_allocs = allocations;
+        start_ns = now_ns();
+    }
+
+    void stop() {
+        ns += now_ns() - start_ns;
+        allocs += allocations - start_allocs;
+    }
+};
+
+static void report(char const *name, Measurement const &m, uint64_t ops) {
+    BenchResult r{(double)m.ns / ops, (double)m.allocs / ops};
+    results[name] = r;
+    std::cout << name << "\t" << r.ns_per_op << " ns/op\t" << r.allocs_per_op << " allocs/op\n";
+}
+
+static std::vector<std::string> bench_names() {
+    std::vector<std::string> names;
+    for (int i = 0; i < BENCH_BOARD_PLAYERS; i++) {
+        names.push_back("player" + std::to_string(i));
+    }
+    return names;
+}
+
+static void bench_crc32() {
+    char buffer[MAX_DATAGRAM_SIZE];
+    memset(buffer, 0x5a, sizeof(buffer));
+    volatile uint32_t sink = 0;
+    Measurement m;
+    m.start();
+    for (size_t i = 0; i < BENCH_CRC_OPS; i++) {
+        sink = sink + get_crc32(buffer, sizeof(buffer));
+    }
+    m.stop();
+    report("crc32_548b", m, BENCH_CRC_OPS);
+}
+
+/* Events as Game writes them, on a board of BENCH_BOARD_PLAYERS players. */
+class GameBench {
+private:
+    Game game;
+    std::list<std::shared_ptr<Player> > players;
+
+    /* Times one event emitted by Game, dropped again so that the log does not grow. */
+    template <typename Emit>
+    void encode(char const *name, Emit emit) {
+        if (!selected(name)) {
+            return;
+        }
+        Measurement m;
+        m.start();
+        for (uint32_t i = 0; i < BENCH_CODEC_OPS; i++) {
+            emit(i);
+            game.events.clear();
+        }
+        m.stop();
+        report(name, m, BENCH_CODEC_OPS);
+    }
+
+public:
+    GameBench() {
+        game.set_settings(BENCH_BOARD_WIDTH, BENCH_BOARD_HEIGHT, BENCH_TURNING_SPEED);
+        for (auto &name : bench_names()) {
+            players.push_back(std::make_shared<Player>(Connection(), name, 0, 0, 0));
+        }
+        game.start(players);
+    }
+
+    /* A game log of count events: NEW_GAME, pixels of the players in turn, an elimination and GAME_OVER. */
+    std::vector<std::shared_ptr<Codec> > log(size_t count) {
+        game.events.clear();
+        game.used_pixels.clear();
+        game.new_game(players);
+        auto p = players.begin();
+        for (uint32_t n = 1; n + 2 < count; n++) {
+            (*p)->set_new_position(n % BENCH_BOARD_WIDTH + 0.5, n % BENCH_BOARD_HEIGHT + 0.5);
+            game.pixel(**p);
+            if (++p == players.end()) {
+                p = players.begin();
+            }
+        }
+        game.player_eliminated(*players.back());
+        game.game_over();
+        return game.events;
+    }
+
+    static void run() {
+        GameBench b;
+        Player &p = *b.players.front();
+        b.encode("codec_encode_new_game", [&b](uint32_t) { b.game.new_game(b.players); });
+        b.encode("codec_encode_pixel", [&b, &p](uint32_t n) {
+            p.set_new_position(n % BENCH_BOARD_WIDTH + 0.5, n % BENCH_BOARD_HEIGHT + 0.5);
+            b.game.pixel(p);
+        });
+        b.encode("codec_encode_player_eliminated", [&b, &p](uint32_t) { b.game.player_eliminated(p); });
+        b.encode("codec_encode_game_over", [&b](uint32_t) { b.game.game_over(); });
+    }
+};
+
+static void bench_player_move() {
+    Player p(Connection(), "bench", 0, 0, 1);
+    p.set_new_position(BENCH_BOARD_WIDTH / 2, BENCH_BOARD_HEIGHT / 2);
+    p.set_rotation(0);
+    volatile uint32_t moved = 0;
+    Measurement m;
+    m.start();
+    for (size_t i = 0; i < BENCH_MOVE_OPS; i++) {
+        moved = moved + p.move(BENCH_TURNING_SPEED);
+    }
+    m.stop();
+    report("player_move", m, BENCH_MOVE_OPS);
+}
+
+/* Game::tick on a board whose every row but the players' own is taken, so that every step looks a pixel up in
+ * a full collision map and adds one to it. An operation is one player's step. */
+static void bench_game_tick() {
+    Game game;
+    game.set_settings(BENCH_BOARD_WIDTH, BENCH_BOARD_HEIGHT, BENCH_TURNING_SPEED);
+    std::list<std::shared_ptr<Player> > players;
+    for (auto &name : bench_names()) {
+        players.push_back(std::make_shared<Player>(Connection(), name, 0, 0, 0));
+    }
+    game.start(players);
+
+    std::set<uint32_t> rows;
+    for (uint32_t i = 0; i < BENCH_BOARD_PLAYERS; i++) {
+        rows.insert(BENCH_BOARD_HEIGHT / BENCH_BOARD_PLAYERS * i);
+    }
+    Measurement m;
+    std::list<std::shared_ptr<Player> > eliminated;
+    for (size_t round = 0; round < BENCH_BOARD_ROUNDS; round++) {
+        auto &pixels = game.get_used_pixels();
+        pixels.clear();
+        for (uint32_t y = 0; y < BENCH_BOARD_HEIGHT; y++) {
+            for (uint32_t x = 0; x < BENCH_BOARD_WIDTH && rows.count(y) == 0; x++) {
+                pixels.insert(std::make_pair(x, y));
+            }
+        }
+        game.get_events().clear();
+        auto row = rows.begin();
+        for (auto &p : game.get_active_players()) {
+            p->set_new_position(0.5, *row++ + 0.5);
+            p->set_rotation(0);
+        }
+
+        m.start();
+        for (size_t tick = 0; tick < BENCH_BOARD_TICKS; tick++) {
+            game.tick(eliminated);
+        }
+        m.stop();
+    }
+    if (!eliminated.empty() || game.get_active_players().size() != BENCH_BOARD_PLAYERS) {
+        std::cerr << "bench players collided\n";
+        exit(EXIT_FAILURE);
+    }
+    report("game_tick_full_board", m, (uint64_t)BENCH_BOARD_ROUNDS * BENCH_BOARD_TICKS * BENCH_BOARD_PLAYERS);
+}
+
+/* Packing as send_message_to_player does it, for BENCH_CLIENTS clients: once per tick, when every client is a
+ * tick behind, and for a catch-up of the whole game with GSO. An operation is one client packed. */
+static void bench_packing() {
+    auto events = GameBench().log(BENCH_EVENTS);
+    std::vector<std::shared_ptr<Player> > clients;
+    for (size_t i = 0; i < BENCH_CLIENTS; i++) {
+        clients.push_back(std::make_shared<Player>(Connection(), "", i, 0, 0));
+    }
+
+    char const *names[] = {"pack_tick_per_client", "pack_catchup_per_client"};
+    uint32_t behind[] = {BENCH_BOARD_PLAYERS, BENCH_EVENTS};
+    size_t rounds[] = {BENCH_PACK_ROUNDS, BENCH_CATCHUP_ROUNDS};
+    for (int b = 0; b < 2; b++) {
+        if (!selected(names[b])) {
+            continue;
+        }
+        Measurement m;
+        for (size_t round = 0; round < rounds[b]; round++) {
+            std::queue<OutgoingDatagram> out;
+            for (auto &client : clients) {
+                client->set_next_expected_event_no(BENCH_EVENTS - behind[b]);
+            }
+            m.start();
+            for (auto &client : clients) {
+                pack_events_for_player(events, 1, client, b == 1, out);
+            }
+            m.stop();
+        }
+        report(names[b], m, rounds[b] * BENCH_CLIENTS);
+    }
+}
+
+/* The server's tick in steady state: Game::tick on an open board, then the tick's events packed for each of
+ * BENCH_CLIENTS clients. An operation is one tick. */
+static void bench_server_tick() {
+    Game game;
+    game.set_settings(BENCH_BOARD_WIDTH, BENCH_BOARD_HEIGHT, BENCH_TURNING_SPEED);
+    std::list<std::shared_ptr<Player> > players;
+    for (auto &name : bench_names()) {
+        players.push_back(std::make_shared<Player>(Connection(), name, 0, 0, 0));
+    }
+    game.start(players);
+    std::vector<std::shared_ptr<Player> > clients;
+    for (size_t i = 0; i < BENCH_CLIENTS; i++) {
+        clients.push_back(std::make_shared<Player>(Connection(), "", i, 0, 0));
+    }
+
+    Measurement m;
+    std::list<std::shared_ptr<Player> > eliminated;
+    for (size_t round = 0; round < BENCH_STEADY_ROUNDS; round++) {
+        game.get_used_pixels().clear();
+        game.get_events().clear();
+        uint32_t row = 0;
+        for (auto &p : game.get_active_players()) {
+            p->set_new_position(0.5, row + 0.5);
+            p->set_rotation(0);
+            row += BENCH_BOARD_HEIGHT / BENCH_BOARD_PLAYERS;
+        }
+
+        for (size_t tick = 0; tick < BENCH_STEADY_TICKS; tick++) {
+            std::queue<OutgoingDatagram> out;
+            for (auto &client : clients) {
+                client->set_next_expected_event_no(game.get_events().size());
+            }
+            m.start();
+            game.tick(eliminated);
+            for (auto &client : clients) {
+                pack_events_for_player(game.get_events(), 1, client, false, out);
+            }
+            m.stop();
+        }
+    }
+    if (!eliminated.empty()) {
+        std::cerr << "bench players collided\n";
+        exit(EXIT_FAILURE);
+    }
+    report("server_tick_steady", m, (uint64_t)BENCH_STEADY_ROUNDS * BENCH_STEADY_TICKS);
+}
+
+/* The governor on a VirtualClock, through cycles of a server loop whose phases take 30% of the tick budget each
+ * until observers are sent every 8th tick, then 5% each until it recovers. Hours of ticks run in a moment, and
+ * the run fails when the governor does not degrade or recover in time. An operation is one tick. */
+static void bench_governor() {
+    VirtualClock clock;
+    Governor governor;
+    governor.set_budget(BENCH_GOVERNOR_TICK_USEC);
+    uint64_t ticks = 0;
+    Measurement m;
+    m.start();
+    for (size_t cycle = 0; cycle < BENCH_GOVERNOR_CYCLES; cycle++) {
+        for (int overloaded = 1; overloaded >= 0; overloaded--) {
+            uint64_t phase_usec = BENCH_GOVERNOR_TICK_USEC * (overloaded ? 30 : 5) / 100;
+            size_t tick = 0;
+            while (overloaded ? governor.observer_stride() < 8 : governor.postpone_observers()) {
+                if (++tick > BENCH_GOVERNOR_MAX_TICKS) {
+                    std::cerr << "governor did not " << (overloaded ? "degrade" : "recover") << " in "
+                              << BENCH_GOVERNOR_MAX_TICKS << " ticks\n";
+                    exit(EXIT_FAILURE);
+                }
+                for (int phase = 0; phase < Governor::PHASES; phase++) {
+                    uint64_t started = clock.update();
+                    clock.advance(phase_usec);
+                    governor.add(static_cast<Governor::Phase>(phase), clock.update() - started);
+                }
+                governor.end_tick();
+                clock.wait(BENCH_GOVERNOR_TICK_USEC - Governor::PHASES * phase_usec);
+                ticks++;
+            }
+        }
+    }
+    m.stop();
+    report("governor_cycle_virtual", m, ticks);
+}
+
+/* Client::process_message_from_server on full datagrams of a game, and on datagrams of a single event of each
+ * type, with the GUI commands it produces. */
+class ClientBench {
+private:
+    /* Times the client parsing a datagram of just event, from the state in which it expects the event. */
+    static void decode(char const *bench, std::shared_ptr<Codec> const &event) {
+        if (!selected(bench)) {
+            return;
+        }
+        char name[] = "screen-worms-bench", host[] = "localhost";
+        char *argv[] = {name, host, nullptr};
+        optind = 1;
+        Client client(2, argv);
+
+        std::vector<std::shared_ptr<Codec> > events(1, event);
+        uint32_t first = 0;
+        auto datagram = pack_events(events, 1, first, MAX_DATAGRAM_SIZE);
+        uint32_t event_no = be32toh(*(uint32_t *)(event->get_data() + 4));
+        uint8_t type = event->get_data()[8];
+        std::vector<std::string> names = type == 0 ? std::vector<std::string>() : bench_names();
+
+        Measurement m;
+        m.start();
+        for (uint32_t i = 0; i < BENCH_CODEC_OPS; i++) {
+            client.active_round = type != 0;
+            client.game_id = type == 0 ? 0 : 1;
+            client.next_expected_event_no = event_no;
+            client.game_names = names;
+            Codec c(datagram->get_len());
+            memcpy(c.get_data(), datagram->get_data(), datagram->get_len());
+            client.process_message_from_server(c, datagram->get_len());
+            while (!client.gui_commands.empty()) {
+                client.gui_commands.pop();
+            }
+        }
+        m.stop();
+        if (client.next_expected_event_no != (type == 3 ? 0 : event_no + 1)) {
+            std::cerr << "bench event was not parsed\n";
+            exit(EXIT_FAILURE);
+        }
+        report(bench, m, BENCH_CODEC_OPS);
+    }
+
+public:
+    static void run_events() {
+        auto events = GameBench().log(BENCH_BOARD_PLAYERS);
+        decode("codec_decode_new_game", events.front());
+        decode("codec_decode_pixel", events[1]);
+        decode("codec_decode_player_eliminated", events[events.size() - 2]);
+        decode("codec_decode_game_over", events.back());
+    }
+
+    static void run() {
+        char name[] = "screen-worms-bench", host[] = "localhost";
+        char *argv[] = {name, host, nullptr};
+        optind = 1;
+        Client client(2, argv);
+
+        auto events = GameBench().log(BENCH_EVENTS);
+        std::vector<std::shared_ptr<Codec> > datagrams;
+        for (uint32_t n = 0; n < events.size();) {
+            datagrams.push_back(pack_events(events, 1, n, MAX_DATAGRAM_SIZE));
+        }
+
+        Measurement m;
+        size_t processed = 0;
+        while (processed < BENCH_CLIENT_DATAGRAMS) {
+            // The game id of the last game would make the client drop the same game again.
+            client.game_id = 0;
+            client.game_names.clear();
+            for (auto &datagram : datagrams) {
+                Codec c(datagram->get_len());
+                memcpy(c.get_data(), datagram->get_data(), datagram->get_len());
+                m.start();
+                client.process_message_from_server(c, datagram->get_len());
+                while (!client.gui_commands.empty()) {
+                    client.gui_commands.pop();
+                }
+                m.stop();
+            }
+            processed += datagrams.size();
+        }
+        if (client.active_round || client.next_expected_event_no != 0) {
+            std::cerr << "bench game was not parsed\n";
+            exit(EXIT_FAILURE);
+        }
+        report("client_process_datagram", m, processed);
+    }
+};
+
+/* Binds a loopback UDP socket on an ephemeral port, used as the receiving end. */
+static int bound_socket(sockaddr_in6 &ip, bool reuseport) {
+    int fd = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd == -1) {
+        std::cerr << "couldn't create socket\n";
+        exit(EXIT_FAILURE);
+    }
+    int flag = 1;
+    if (reuseport) {
+        setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag));
+    }
+    socklen_t len = sizeof(ip);
+    if (bind(fd, (sockaddr *)&ip, sizeof(ip)) < 0 || getsockname(fd, (sockaddr *)&ip, &len) < 0) {
+        std::cerr << "cannot bind\n";
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+/* Compares per-packet cost of sendto on the shared server socket with send on a connected per-client socket. */
+static void bench_udp_send() {
+    sockaddr_in6 server_ip, client_ip;
+    memset(&server_ip, 0, sizeof(server_ip));
+    server_ip.sin6_family = AF_INET6;
+    server_ip.sin6_addr = in6addr_loopback;
+    client_ip = server_ip;
+
+    int client_fd = bound_socket(client_ip, false);
+    int server_fd = bound_socket(server_ip, true);
+    int connected_fd = bound_socket(server_ip, true);
+    if (connect(connected_fd, (sockaddr *)&client_ip, sizeof(client_ip)) < 0) {
+        std::cerr << "cannot connect\n";
+        exit(EXIT_FAILURE);
+    }
+
+    char buffer[MAX_DATAGRAM_SIZE];
+    memset(buffer, 0, sizeof(buffer));
+    char drain[MAX_DATAGRAM_SIZE];
+
+    Measurement m;
+    m.start();
+    for (size_t i = 0; i < BENCH_PACKETS; i++) {
+        sendto(server_fd, buffer, sizeof(buffer), 0, (sockaddr *)&client_ip, sizeof(client_ip));
+        while (recv(client_fd, drain, sizeof(drain), 0) > 0) {
+        }
+    }
+    m.stop();
+    report("udp_sendto_shared", m, BENCH_PACKETS);
+
+    m = Measurement();
+    m.start();
+    for (size_t i = 0; i < BENCH_PACKETS; i++) {
+        send(connected_fd, buffer, sizeof(buffer), 0);
+        while (recv(client_fd, drain, sizeof(drain), 0) > 0) {
+        }
+    }
+    m.stop();
+    report("udp_send_connected", m, BENCH_PACKETS);
+
+    close(connected_fd);
+    close(server_fd);
+    close(client_fd);
+}
+
+/* Compares a catch-up burst sent datagram by datagram with the same burst handed over in one UDP_SEGMENT send. */
+static void bench_udp_gso() {
+    sockaddr_in6 server_ip, client_ip;
+    memset(&server_ip, 0, sizeof(server_ip));
+    server_ip.sin6_family = AF_INET6;
+    server_ip.sin6_addr = in6addr_loopback;
+    client_ip = server_ip;
+
+    int client_fd = bound_socket(client_ip, false);
+    int server_fd = bound_socket(server_ip, false);
+    int rcvbuf = 4 * 1024 * 1024;
+    setsockopt(client_fd, SOL_SOCKET, SO_RCVBUF, &rcvbuf, sizeof(rcvbuf));
+
+    static char buffer[BENCH_GSO_SEGMENTS * MAX_DATAGRAM_SIZE];
+    memset(buffer, 0, sizeof(buffer));
+    char drain[MAX_DATAGRAM_SIZE];
+    size_t bursts = BENCH_PACKETS / BENCH_GSO_SEGMENTS;
+
+    Measurement m;
+    m.start();
+    for (size_t i = 0; i < bursts; i++) {
+        for (size_t j = 0; j < BENCH_GSO_SEGMENTS; j++) {
+            sendto(server_fd, buffer + j * MAX_DATAGRAM_SIZE, MAX_DATAGRAM_SIZE, 0, (sockaddr *)&client_ip,
+                   sizeof(client_ip));
+        }
+        while (recv(client_fd, drain, sizeof(drain), 0) > 0) {
+        }
+    }
+    m.stop();
+    report("udp_burst_sendto", m, bursts * BENCH_GSO_SEGMENTS);
+
+    int segment = MAX_DATAGRAM_SIZE;
+    if (setsockopt(server_fd, SOL_UDP, UDP_SEGMENT, &segment, sizeof(segment)) == -1) {
+        std::cout << "udp_burst_gso\tunsupported\n";
+    } else {
+        m = Measurement();
+        m.start();
+        for (size_t i = 0; i < bursts; i++) {
+            sendto(server_fd, buffer, sizeof(buffer), 0, (sockaddr *)&client_ip, sizeof(client_ip));
+            while (recv(client_fd, drain, sizeof(drain), 0) > 0) {
+            }
+        }
+        m.stop();
+        report("udp_burst_gso", m, bursts * BENCH_GSO_SEGMENTS);
+    }
+
+    close(server_fd);
+    close(client_fd);
+}
+
+/* Baseline file: one benchmark per line, its name, ns/op and allocs/op. */
+static void write_baseline(std::string const &path) {
+    std::ofstream file(path);
+    for (auto &r : results) {
+        file << r.first << " " << r.second.ns_per_op << " " << r.second.allocs_per_op << "\n";
+    }
+    if (!file) {
+        std::cerr << "couldn't write baseline " << path << "\n";
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* Returns the number of benchmarks that are slower than the baseline by more than threshold percent, or that
+ * allocate more. */
+static size_t compare_baseline(std::string const &path, uint32_t threshold) {
+    std::ifstream file(path);
+    if (!file) {
+        std::cerr << "couldn't read baseline " << path << "\n";
+        exit(EXIT_FAILURE);
+    }
+    size_t regressions = 0;
+    std::string name;
+    BenchResult base;
+    while (file >> name >> base.ns_per_op >> base.allocs_per_op) {
+        auto r = results.find(name);
+        if (r == results.end()) {
+            continue;
+        }
+        double change = base.ns_per_op > 0 ? (r->second.ns_per_op / base.ns_per_op - 1) * 100 : 0;
+        bool slower = change > threshold;
+        bool allocates = r->second.allocs_per_op > base.allocs_per_op + 0.005;
+        if (slower || allocates) {
+            regressions++;
+        }
+        std::cout << (slower || allocates ? "REGRESSION\t" : "ok\t") << name << "\t" << (change >= 0 ? "+" : "")
+                  << change << "% time\t" << base.allocs_per_op << " -> " << r->second.allocs_per_op
+                  << " allocs/op\n";
+    }
+    return regressions;
+}
+
+int main(int argc, char *argv[]) {
+    std::string baseline, output;
+    uint32_t threshold = DEFAULT_BENCH_THRESHOLD;
+    int64_t budget = -1;
+    int opt;
+    while ((opt = getopt(argc, argv, "b:w:t:f:a:")) != -1) {
+        if (opt == 'b') {
+            baseline = optarg;
+        } else if (opt == 'w') {
+            output = optarg;
+        } else if (opt == 'f') {
+            filter = optarg;
+        } else if (opt == 't' || opt == 'a') {
+            uint32_t parsed;
+            try {
+                parsed = string_to_uint32_t(optarg);
+            } catch (UtilityError const &e) {
+                std::cerr << static_cast<char>(opt) << ": " << e.what() << " '" << optarg << "'\n";
+                exit(EXIT_FAILURE);
+            }
+            if (opt == 't') {
+                threshold = parsed;
+            } else {
+                budget = parsed;
+            }
+        } else {
+            std::cerr << "Usage " << argv[0]
+                      << " [-b baseline] [-w baseline] [-t percent] [-f filter] [-a tick_alloc_budget]\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    build_crc32_table();
+
+    if (selected("crc32_548b")) {
+        bench_crc32();
+    }
+    GameBench::run();
+    ClientBench::run_events();
+    if (selected("player_move")) {
+        bench_player_move();
+    }
+    if (selected("game_tick_full_board")) {
+        bench_game_tick();
+    }
+    bench_packing();
+    if (selected("server_tick_steady")) {
+        bench_server_tick();
+    }
+    if (selected("governor_cycle_virtual")) {
+        bench_governor();
+    }
+    if (selected("client_process_datagram")) {
+        ClientBench::run();
+    }
+    if (selected("udp_sendto_shared") || selected("udp_send_connected")) {
+        bench_udp_send();
+    }
+    if (selected("udp_burst_sendto") || selected("udp_burst_gso")) {
+        bench_udp_gso();
+    }
+
+    if (!output.empty()) {
+        write_baseline(output);
+    }
+    bool failed = !baseline.empty() && compare_baseline(baseline, threshold) > 0;
+    auto tick = results.find("server_tick_steady");
+    if (budget >= 0 && tick != results.end() && tick->second.allocs_per_op > budget) {
+        std::cout << "OVER BUDGET\tserver_tick_steady\t" << tick->second.allocs_per_op << " allocs/op, budget "
+                  << budget << "\n";
+        failed = true;
+    }
+    return failed ? 1 : 0;
+}
@@ -1,7 +1,9 @@
 #include "client.h"
+#include "trace.h"
 
 int main(int argc, char* argv[]) {
     build_crc32_table();
+    TRACE_SETUP("screen-worms-client");
 
     Client client(argc, argv);
     client.connect_to_gui();
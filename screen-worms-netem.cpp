@@ -0,0 +1,423 @@
+#include "clock.h"
+#include "connection.h"
+#include "protocol.h"
+#include "utility.h"
+
+#include <cerrno>
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <netinet/in.h>
+#include <poll.h>
+#include <queue>
+#include <random>
+#include <sstream>
+#include <vector>
+
+#define DEFAULT_SERVER_PORT 2021
+#define DEFAULT_NETEM_PORT 2025
+#define MAX_PORT 65535
+
+#define NETEM_IDLE_USEC 10 * 1000 * 1000 // clients silent this long are forgotten
+#define NETEM_IDLE_CHECK_USEC 1000000
+#define NETEM_MAX_CLIENTS 1024
+#define DEFAULT_NETEM_HOLD_MSEC 20
+
+/* Network impairment proxy: forwards UDP between clients and a server, dropping, delaying, reordering and
+ * duplicating datagrams on the way, to test loss recovery and catch-up on one machine without tc netem.
+ *
+ * Each client gets its own socket towards the server, so the server tells clients apart as it would without the
+ * proxy. Each direction has its own impairment profile and its own random generator seeded from -s, so that
+ * a run repeats exactly as long as the same datagrams arrive in the same order. With -l every datagram's fate is
+ * logged, one line each: time (usec since start), direction, client, length, fate and delay (usec). */
+
+static void usage(char const *name) {
+    std::cerr << "Usage " << name << " [-p server_port] [-P proxy_port] [-u profile] [-d profile] [-s seed]"
+              << " [-l log] [host]\n"
+              << "A profile is a preset (none, wifi, mobile, bad) and/or comma separated loss=%, delay=ms,"
+              << " jitter=ms, reorder=%, hold=ms, duplicate=%,\ne.g. -u wifi -d mobile,loss=5\n";
+    exit(EXIT_FAILURE);
+}
+
+/* Impairments of one direction. A reordered datagram is held back hold_msec more than others, so that those
+ * sent after it overtake it. */
+struct Profile {
+    double loss = 0;
+    double delay_msec = 0;
+    double jitter_msec = 0;
+    double reorder = 0;
+    double hold_msec = DEFAULT_NETEM_HOLD_MSEC;
+    double duplicate = 0;
+};
+
+static double parse_number(std::string const &key, std::string const &value) {
+    char *end;
+    double parsed = strtod(value.c_str(), &end);
+    if (value.empty() || *end != '\0' || parsed < 0) {
+        std::cerr << key << ": incorrect value '" << value << "'\n";
+        exit(EXIT_FAILURE);
+    }
+    return parsed;
+}
+
+static Profile preset(double loss, double delay_msec, double jitter_msec, double reorder, double duplicate) {
+    Profile p;
+    p.loss = loss;
+    p.delay_msec = delay_msec;
+    p.jitter_msec = jitter_msec;
+    p.reorder = reorder;
+    p.duplicate = duplicate;
+    return p;
+}
+
+/* Parses a profile: presets set every impairment, keys after them override single ones. */
+static Profile parse_profile(std::string const &spec) {
+    Profile p;
+    std::stringstream items(spec);
+    std::string item;
+    while (std::getline(items, item, ',')) {
+        size_t eq = item.find('=');
+        if (eq == std::string::npos) {
+            if (item == "none") {
+                p = Profile();
+            } else if (item == "wifi") {
+                p = preset(1, 5, 5, 0, 0);
+            } else if (item == "mobile") {
+                p = preset(3, 40, 20, 2, 0.5);
+            } else if (item == "bad") {
+                p = preset(10, 100, 50, 5, 2);
+            } else {
+                std::cerr << "Unknown profile '" << item << "'\n";
+                exit(EXIT_FAILURE);
+            }
+            continue;
+        }
+        std::string key = item.substr(0, eq);
+        double value = parse_number(key, item.substr(eq + 1));
+        if (key == "loss") {
+            p.loss = value;
+        } else if (key == "delay") {
+            p.delay_msec = value;
+        } else if (key == "jitter") {
+            p.jitter_msec = value;
+        } else if (key == "reorder") {
+            p.reorder = value;
+        } else if (key == "hold") {
+            p.hold_msec = value;
+        } else if (key == "duplicate") {
+            p.duplicate = value;
+        } else {
+            std::cerr << "Unknown impairment '" << key << "'\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (p.loss > 100 || p.reorder > 100 || p.duplicate > 100) {
+        std::cerr << "Percentages have to be at most 100\n";
+        exit(EXIT_FAILURE);
+    }
+    return p;
+}
+
+/* One direction: its profile, generator and what happened to its datagrams. */
+struct Direction {
+    char const *name;
+    Profile profile;
+    std::mt19937_64 random;
+    uint64_t received = 0, dropped = 0, duplicated = 0, reordered = 0, sent = 0;
+};
+
+/* Datagram waiting for its delay to pass. seq keeps datagrams due at the same time in arrival order. */
+struct Delayed {
+    uint64_t due;
+    uint64_t seq;
+    int fd;
+    Connection to;
+    std::shared_ptr<std::string> data;
+    Direction *direction;
+
+    bool operator>(Delayed const &other) const {
+        return due != other.due ? due > other.due : seq > other.seq;
+    }
+};
+
+struct NetemClient {
+    int number;
+    int fd;
+    uint64_t last_seen;
+    uint64_t delayed; /* Datagrams still queued to be sent from fd. */
+};
+
+static volatile sig_atomic_t stop_requested = 0;
+
+static void request_stop(int) {
+    stop_requested = 1;
+}
+
+class Netem {
+private:
+    MonotonicClock clock;
+    uint64_t start;
+    int listen_fd;
+    Connection server;
+    Direction up, down;
+    FILE *log;
+
+    std::map<Connection, NetemClient> clients;
+    std::map<int, Connection> client_by_fd;
+    int next_client_number = 0;
+    uint64_t last_idle_check = 0;
+
+    std::priority_queue<Delayed, std::vector<Delayed>, std::greater<Delayed> > delayed;
+    uint64_t next_seq = 0;
+
+    bool chance(Direction &d, double percent);
+    int impair(Direction &d, int fd, Connection const &to, int client, char const *data, ssize_t len);
+    void from_client(char const *data, ssize_t len, Connection const &from);
+    void forget_idle();
+    void send_due();
+
+public:
+    Netem(uint32_t proxy_port, Connection const &server, Profile const &up_profile, Profile const &down_profile,
+          uint64_t seed, FILE *log);
+    void run();
+    void print_summary();
+};
+
+Netem::Netem(uint32_t proxy_port, Connection const &server, Profile const &up_profile,
+             Profile const &down_profile, uint64_t seed, FILE *log)
+    : server(server), log(log) {
+    up.name = "up";
+    up.profile = up_profile;
+    up.random.seed(seed);
+    down.name = "down";
+    down.profile = down_profile;
+    down.random.seed(seed + 1);
+
+    listen_fd = socket(AF_INET6, SOCK_DGRAM, 0);
+    sockaddr_in6 ip;
+    memset(&ip, 0, sizeof(ip));
+    ip.sin6_family = AF_INET6;
+    ip.sin6_port = htobe16(proxy_port);
+    ip.sin6_addr = in6addr_any;
+    if (listen_fd == -1 || bind(listen_fd, (sockaddr *)&ip, sizeof(ip)) == -1) {
+        std::cerr << "cannot bind on port " << proxy_port << "\n";
+        exit(EXIT_FAILURE);
+    }
+    start = clock.update();
+}
+
+bool Netem::chance(Direction &d, double percent) {
+    return std::uniform_real_distribution<double>(0, 100)(d.random) < percent;
+}
+
+/* Decides the fate of a datagram and queues the copies that survive. Every random number is drawn whatever the
+ * profile, so that changing one impairment does not change the decisions of the others. Returns how many
+ * copies were queued. */
+int Netem::impair(Direction &d, int fd, Connection const &to, int client, char const *data, ssize_t len) {
+    uint64_t now = clock.now();
+    d.received++;
+    bool lost = chance(d, d.profile.loss);
+    bool duplicated = chance(d, d.profile.duplicate);
+    bool reordered = chance(d, d.profile.reorder);
+    double jitters[2];
+    for (double &jitter : jitters) {
+        jitter = std::uniform_real_distribution<double>(-1, 1)(d.random) * d.profile.jitter_msec;
+    }
+    if (lost) {
+        d.dropped++;
+        if (log != nullptr) {
+            fprintf(log, "%lu\t%s\t%d\t%zd\tdrop\t0\n", (unsigned long)(now - start), d.name, client, len);
+        }
+        return 0;
+    }
+
+    auto copy = std::make_shared<std::string>(data, len);
+    d.duplicated += duplicated;
+    d.reordered += reordered;
+    for (int i = 0; i < (duplicated ? 2 : 1); i++) {
+        double msec = d.profile.delay_msec + jitters[i] + (reordered && i == 0 ? d.profile.hold_msec : 0);
+        uint64_t delay = msec > 0 ? (uint64_t)(msec * 1000) : 0;
+        delayed.push(Delayed{now + delay, next_seq++, fd, to, copy, &d});
+        if (log != nullptr) {
+            char const *fate = i == 1 ? "duplicate" : (reordered ? "reorder" : "pass");
+            fprintf(log, "%lu\t%s\t%d\t%zd\t%s\t%lu\n", (unsigned long)(now - start), d.name, client, len, fate,
+                    (unsigned long)delay);
+        }
+    }
+    return duplicated ? 2 : 1;
+}
+
+/* A new client gets its own unconnected socket towards the server, which answers from per-client sockets of
+ * its own. */
+void Netem::from_client(char const *data, ssize_t len, Connection const &from) {
+    auto itr = clients.find(from);
+    if (itr == clients.end()) {
+        if (clients.size() >= NETEM_MAX_CLIENTS) {
+            return;
+        }
+        int fd = socket(server.get_family(), SOCK_DGRAM, 0);
+        if (fd == -1) {
+            return;
+        }
+        itr = clients.insert(std::make_pair(from, NetemClient{next_client_number++, fd, 0, 0})).first;
+        client_by_fd[fd] = from;
+    }
+    itr->second.last_seen = clock.now();
+    itr->second.delayed += impair(up, itr->second.fd, server, itr->second.number, data, len);
+}
+
+/* Clients are forgotten long after their last datagram, once nothing queued is still to be sent from their socket. */
+void Netem::forget_idle() {
+    for (auto itr = clients.begin(); itr != clients.end();) {
+        if (clock.now() - itr->second.last_seen > NETEM_IDLE_USEC && itr->second.delayed == 0) {
+            client_by_fd.erase(itr->second.fd);
+            close(itr->second.fd);
+            itr = clients.erase(itr);
+        } else {
+            ++itr;
+        }
+    }
+}
+
+void Netem::send_due() {
+    while (!delayed.empty() && delayed.top().due <= clock.now()) {
+        Delayed const &d = delayed.top();
+        if (sendto(d.fd, d.data->data(), d.data->size(), 0, (sockaddr *)d.to.addr(), d.to.len()) >= 0) {
+            d.direction->sent++;
+        }
+        auto client = client_by_fd.find(d.fd);
+        if (client != client_by_fd.end()) {
+            clients[client->second].delayed--;
+        }
+        delayed.pop();
+    }
+}
+
+void Netem::run() {
+    static char data[MAX_UDP_PAYLOAD];
+    std::vector<pollfd> polls;
+    while (!stop_requested) {
+        polls.assign(1, pollfd{listen_fd, POLLIN, 0});
+        for (auto &client : clients) {
+            polls.push_back(pollfd{client.second.fd, POLLIN, 0});
+        }
+        int timeout = -1;
+        if (!delayed.empty()) {
+            uint64_t due = delayed.top().due;
+            timeout = due > clock.now() ? (due - clock.now() + 999) / 1000 : 0;
+        }
+        if (timeout == -1 || timeout > NETEM_IDLE_CHECK_USEC / 1000) {
+            timeout = NETEM_IDLE_CHECK_USEC / 1000;
+        }
+        poll(polls.data(), polls.size(), timeout);
+        clock.update();
+
+        for (auto &pfd : polls) {
+            if (!(pfd.revents & POLLIN)) {
+                continue;
+            }
+            Connection from;
+            ssize_t len = recvfrom(pfd.fd, data, sizeof(data), 0, (sockaddr *)from.addr(), from.len_ptr());
+            if (len < 0) {
+                continue;
+            }
+            if (pfd.fd == listen_fd) {
+                from_client(data, len, from);
+            } else {
+                auto client = client_by_fd.find(pfd.fd);
+                if (client != client_by_fd.end()) {
+                    impair(down, listen_fd, client->second, clients[client->second].number, data, len);
+                }
+            }
+        }
+        send_due();
+
+        if (clock.now() - last_idle_check >= NETEM_IDLE_CHECK_USEC) {
+            forget_idle();
+            last_idle_check = clock.now();
+        }
+    }
+}
+
+void Netem::print_summary() {
+    std::cout << "direction\treceived\tdropped\tduplicated\treordered\tsent\n";
+    for (Direction const *d : {&up, &down}) {
+        std::cout << d->name << "\t" << d->received << "\t" << d->dropped << "\t" << d->duplicated << "\t"
+                  << d->reordered << "\t" << d->sent << "\n";
+    }
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t port = DEFAULT_SERVER_PORT, proxy_port = DEFAULT_NETEM_PORT, seed = 1;
+    std::string host = "localhost", log_path;
+    Profile up, down;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:P:u:d:s:l:")) != -1) {
+        if (opt == 'u') {
+            up = parse_profile(optarg);
+        } else if (opt == 'd') {
+            down = parse_profile(optarg);
+        } else if (opt == 'l') {
+            log_path = optarg;
+        } else if (opt == 'p' || opt == 'P' || opt == 's') {
+            uint32_t parsed;
+            try {
+                parsed = string_to_uint32_t(optarg);
+            } catch (UtilityError const &e) {
+                std::cerr << static_cast<char>(opt) << ": " << e.what() << " '" << optarg << "'\n";
+                exit(EXIT_FAILURE);
+            }
+            if (opt == 'p') {
+                port = parsed;
+            } else if (opt == 'P') {
+                proxy_port = parsed;
+            } else {
+                seed = parsed;
+            }
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind > 1) {
+        usage(argv[0]);
+    }
+    if (optind < argc) {
+        host = argv[optind];
+    }
+    if (port > MAX_PORT || proxy_port > MAX_PORT) {
+        std::cerr << "Incorrect port number\n";
+        exit(EXIT_FAILURE);
+    }
+
+    FILE *log = nullptr;
+    if (!log_path.empty()) {
+        log = fopen(log_path.c_str(), "w");
+        if (log == nullptr) {
+            std::cerr << "couldn't open " << log_path << "\n";
+            exit(EXIT_FAILURE);
+        }
+        fprintf(log, "usec\tdirection\tclient\tlen\tfate\tdelay_usec\n");
+    }
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    Netem netem(proxy_port, Connection(host.c_str(), port, hints), up, down, seed, log);
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_stop;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+
+    netem.run();
+    if (log != nullptr) {
+        fclose(log);
+    }
+    netem.print_summary();
+}
@@ -0,0 +1,114 @@
+#include "capture.h"
+#include "clock.h"
+#include "utility.h"
+
+#include <algorithm>
+#include <cstring>
+#include <map>
+#include <poll.h>
+
+#define DEFAULT_SERVER_PORT 2021
+#define MAX_PORT 65535
+#define MAX_SPEED 1000
+
+/* Replays a traffic capture of the server against a server: every datagram is sent at its captured time,
+ * divided by the speed, from a local socket standing for its captured source address. Answers are read and
+ * counted so that the server's sends never block on full receive buffers. */
+
+static void usage(char const *name) {
+    std::cerr << "Usage " << name << " [-p n] [-x speed] capture_file game_server\n";
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    uint32_t port = DEFAULT_SERVER_PORT, speed = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "p:x:")) != -1) {
+        if (opt == '?') {
+            usage(argv[0]);
+        }
+        uint32_t parsed;
+        try {
+            parsed = string_to_uint32_t(optarg);
+        } catch (UtilityError const &e) {
+            std::cerr << static_cast<char>(opt) << ": " << e.what() << " '" << optarg << "'\n";
+            exit(EXIT_FAILURE);
+        }
+        if (opt == 'p') {
+            port = parsed;
+        } else {
+            speed = parsed;
+        }
+    }
+    if (argc - optind != 2) {
+        usage(argv[0]);
+    }
+    if (port > MAX_PORT || speed == 0 || speed > MAX_SPEED) {
+        std::cerr << "Incorrect port number or speed\n";
+        exit(EXIT_FAILURE);
+    }
+
+    std::vector<CapturedDatagram> datagrams;
+    if (!load_capture(argv[optind], datagrams)) {
+        std::cerr << "couldn't read capture " << argv[optind] << "\n";
+        exit(EXIT_FAILURE);
+    }
+    if (datagrams.empty()) {
+        return 0;
+    }
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    Connection server(argv[optind + 1], port, hints);
+
+    /* One local socket per captured source, created when the source first appears. */
+    std::map<Connection, int> sources;
+    std::vector<pollfd> polls;
+    uint64_t answers = 0, answer_bytes = 0;
+    char buffer[65536];
+
+    MonotonicClock clock;
+    uint64_t start = clock.update();
+    uint64_t first = datagrams.front().timestamp;
+    for (auto &d : datagrams) {
+        // Arrival times of one batch may be slightly out of order across sockets.
+        uint64_t due = start + (std::max(d.timestamp, first) - first) / speed;
+
+        /* Until the datagram is due, read whatever the server answers. */
+        do {
+            uint64_t now = clock.update();
+            int timeout = now >= due ? 0 : (int)((due - now + 999) / 1000);
+            if (poll(polls.data(), polls.size(), timeout) > 0) {
+                for (auto &pfd : polls) {
+                    ssize_t len;
+                    while ((pfd.revents & POLLIN) && (len = recv(pfd.fd, buffer, sizeof(buffer), 0)) > 0) {
+                        answers++;
+                        answer_bytes += len;
+                    }
+                }
+            }
+        } while (clock.update() < due);
+
+        auto source = sources.find(d.from);
+        if (source == sources.end()) {
+            int fd = socket(server.get_family(), SOCK_DGRAM | SOCK_NONBLOCK, 0);
+            if (fd == -1 || connect(fd, (sockaddr *)server.addr(), server.len()) == -1) {
+                std::cerr << "couldn't create socket\n";
+                exit(EXIT_FAILURE);
+            }
+            source = sources.insert(std::make_pair(d.from, fd)).first;
+            pollfd pfd;
+            pfd.fd = fd;
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+            polls.push_back(pfd);
+        }
+        send(source->second, d.data, d.len, 0);
+    }
+
+    uint64_t usec = std::max<uint64_t>(1, clock.update() - start);
+    std::cout << "sent\t" << datagrams.size() << " datagrams from " << sources.size() << " sources in " << usec / 1000
+              << " ms\n";
+    std::cout << "answers\t" << answers << " datagrams, " << answer_bytes << " bytes\n";
+}
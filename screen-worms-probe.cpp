@@ -0,0 +1,564 @@
+#include "clock.h"
+#include "codec.h"
+#include "connection.h"
+#include "player.h"
+#include "protocol.h"
+#include "utility.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <poll.h>
+#include <random>
+#include <sstream>
+#include <sys/wait.h>
+
+#define DEFAULT_SERVER_PORT 2021
+#define DEFAULT_GUI_PORT 20210
+#define DEFAULT_PROXY_PORT 2024
+#define DEFAULT_PROBE_SAMPLES 50
+#define DEFAULT_PROBE_RATE 50
+#define DEFAULT_PROBE_TURNING_SPEED 90
+#define MAX_PORT 65535
+
+#define PROBE_NAME "probe"
+#define COMPANION_NAME "zcompanion"
+#define PROBE_HOLD_USEC 70000 // key held, then released, in the lobby: long enough for two heartbeats
+#define PROBE_MIN_SETTLE_USEC 200000
+#define PROBE_MAX_SETTLE_USEC 500000
+#define PROBE_START_USEC 300000
+#define PROBE_POLL_MSEC 5
+
+/* Measures the latency a player feels, from a key press in the GUI to the first PIXEL line that shows the turn.
+ * The probe stands in for the GUI of a screen-worms-client and relays the client's UDP traffic to the server, so
+ * it sees every step:
+ *   key press -> heartbeat carrying the turn leaves the client   (client waits for its next heartbeat)
+ *             -> datagram with the first turned pixel comes back (server waits for its tick, ticks, fans out)
+ *             -> PIXEL line of that pixel reaches the GUI        (client decodes and forwards)
+ * A pixel shows the turn when no straight run from the worm's start could have produced it; the start position
+ * is exact and every rotation is tried, using the server's own Player::move.
+ *
+ * A companion player, steered by the probe, makes the server start games. Every game gives one sample: the
+ * worm goes straight for a random while, then turns. */
+
+static void usage(char const *name) {
+    std::cerr << "Usage " << name << " [-n samples] [-p port] [-g gui_port] [-P proxy_port] [-B server_binary]"
+              << " [-v rate] [-t turning_speed] [-C client_binary] [-a] [host]\n";
+    exit(EXIT_FAILURE);
+}
+
+/* Latencies of one step over all samples. */
+class Step {
+private:
+    std::vector<uint64_t> samples;
+
+public:
+    void record(uint64_t usec) {
+        samples.push_back(usec);
+    }
+
+    void print(char const *name) {
+        std::sort(samples.begin(), samples.end());
+        std::cout << name;
+        if (samples.empty()) {
+            std::cout << "\t-\n";
+            return;
+        }
+        double fractions[] = {0, 0.5, 0.9, 0.99};
+        for (double f : fractions) {
+            std::cout << "\t" << samples[(size_t)(f * (samples.size() - 1))] / 1000.0;
+        }
+        std::cout << "\t" << samples.back() / 1000.0 << "\n";
+    }
+};
+
+class Probe {
+private:
+    enum State { LOBBY, SETTLING, TURNING };
+
+    MonotonicClock clock;
+    std::mt19937 random{1};
+    uint32_t turning_speed;
+
+    int listen_fd;
+    int gui_fd = -1;
+    int proxy_fd;
+    int upstream_fd;
+    Connection server;
+    int companion_fd = -1;
+    Connection client;
+    std::string gui_buffer;
+
+    /* The probe's game, as the client follows it: events are taken in order only. */
+    State state = LOBBY;
+    bool active_round = false;
+    uint32_t game_id = 0;
+    uint32_t next_expected_event_no = 0;
+    int probe_number = -1;
+    bool probe_alive = false;
+    uint32_t pixels = 0;
+    uint32_t gui_pixels = 0;
+
+    /* Straight runs from the start that still match every pixel of the worm. */
+    std::vector<std::unique_ptr<Player> > straight;
+    uint64_t turn_at = 0;
+
+    /* The sample in progress: key press, heartbeat carrying it, datagram and GUI line with the turned pixel. */
+    uint64_t pressed = 0, heartbeat = 0, datagram = 0;
+    uint32_t turned_pixel = 0;
+
+    /* Getting ready between games: key pressed, key released, companion ready; each step at lobby_step_at. */
+    int lobby_step = 0;
+    uint64_t lobby_step_at = 0;
+    uint64_t companion_session = 0;
+    uint64_t companion_heartbeat = 0;
+
+    void key(char const *line);
+    void companion_send(uint8_t turn);
+    void from_client(char *data, ssize_t len);
+    void from_server(char *data, ssize_t len);
+    void probe_pixel(uint32_t x, uint32_t y);
+    bool from_gui();
+    void lobby(uint64_t now);
+
+public:
+    size_t wanted;
+    size_t collected = 0;
+    uint32_t lost = 0;
+    /* The server does not take the winner of a game back to the lobby, so a probe's worm that wins needs a new
+     * client, with a new session. */
+    bool stranded = false;
+    Step to_heartbeat, in_server, to_gui, total;
+
+    Probe(uint32_t gui_port, uint32_t proxy_port, Connection const &server, uint32_t turning_speed,
+          bool companion, size_t wanted);
+    void accept_gui();
+    void run();
+};
+
+static int bound_socket(int type, uint32_t port) {
+    int fd = socket(AF_INET6, type, 0);
+    int flag = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &flag, sizeof(flag));
+    sockaddr_in6 ip;
+    memset(&ip, 0, sizeof(ip));
+    ip.sin6_family = AF_INET6;
+    ip.sin6_port = htobe16(port);
+    ip.sin6_addr = in6addr_any;
+    if (fd == -1 || bind(fd, (sockaddr *)&ip, sizeof(ip)) == -1) {
+        std::cerr << "cannot bind on port " << port << "\n";
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+/* The server answers a client from a socket of its own, so only a socket that is not connected sees the
+ * answers; the companion ignores them and can be connected. */
+static int server_socket(Connection const &server, bool connected) {
+    int fd = socket(server.get_family(), SOCK_DGRAM, 0);
+    if (fd == -1 || (connected && connect(fd, (sockaddr *)server.addr(), server.len()) == -1)) {
+        std::cerr << "couldn't connect to server\n";
+        exit(EXIT_FAILURE);
+    }
+    return fd;
+}
+
+Probe::Probe(uint32_t gui_port, uint32_t proxy_port, Connection const &server, uint32_t turning_speed,
+             bool companion, size_t wanted)
+    : turning_speed(turning_speed), server(server), wanted(wanted) {
+    listen_fd = bound_socket(SOCK_STREAM, gui_port);
+    if (listen(listen_fd, 1) == -1) {
+        std::cerr << "cannot listen on port " << gui_port << "\n";
+        exit(EXIT_FAILURE);
+    }
+    proxy_fd = bound_socket(SOCK_DGRAM, proxy_port);
+    upstream_fd = server_socket(server, false);
+    if (companion) {
+        companion_fd = server_socket(server, true);
+    }
+}
+
+/* Waits for a client to connect to its GUI; a new client starts out in the lobby. */
+void Probe::accept_gui() {
+    if (gui_fd != -1) {
+        close(gui_fd);
+    }
+    gui_fd = accept(listen_fd, nullptr, nullptr);
+    gui_buffer.clear();
+    state = LOBBY;
+    active_round = stranded = false;
+    next_expected_event_no = 0;
+    lobby_step = 0;
+    if (gui_fd == -1) {
+        std::cerr << "couldn't accept gui connection\n";
+        exit(EXIT_FAILURE);
+    }
+    int flag = 1;
+    setsockopt(gui_fd, IPPROTO_TCP, TCP_NODELAY, &flag, sizeof(flag));
+}
+
+void Probe::key(char const *line) {
+    if (send(gui_fd, line, strlen(line), 0) <= 0) {
+        std::cerr << "connection with client lost\n";
+        exit(EXIT_FAILURE);
+    }
+}
+
+void Probe::companion_send(uint8_t turn) {
+    Codec c;
+    c.add_uint64_t(companion_session);
+    c.add_uint8_t(turn);
+    c.add_uint32_t(0);
+    c.add_string(COMPANION_NAME, false);
+    send(companion_fd, c.get_data(), c.get_len(), 0);
+    companion_heartbeat = clock.now();
+}
+
+/* Heartbeats go to the server unchanged; the first one carrying the injected turn completes the first step. */
+void Probe::from_client(char *data, ssize_t len) {
+    sendto(upstream_fd, data, len, 0, (sockaddr *)server.addr(), server.len());
+    if (state == TURNING && heartbeat == 0 && len > 8 && data[8] != 0) {
+        heartbeat = clock.now();
+    }
+}
+
+/* Datagrams go to the client unchanged, and are followed the way the client follows them. */
+void Probe::from_server(char *data, ssize_t len) {
+    sendto(proxy_fd, data, len, 0, (sockaddr *)client.addr(), client.len());
+
+    Codec c(len);
+    memcpy(c.get_data(), data, len);
+    try {
+        uint32_t id = c.read_uint32_t();
+        if ((active_round && id != game_id) || (!active_round && id == game_id)) {
+            return;
+        }
+        while (c.has_data()) {
+            uint32_t event_len = c.read_uint32_t();
+            if (!check_crc32((char *)c.get_pos() - 4, event_len + 4, c.read_crc(event_len))) {
+                return;
+            }
+            uint32_t event_no = c.read_uint32_t();
+            uint8_t type = c.read_uint8_t();
+            if (event_no != next_expected_event_no || (!active_round && type != 0)) {
+                c.skip_pos(event_len - 5 + 4);
+                continue;
+            }
+            next_expected_event_no++;
+
+            if (type == 0) {
+                active_round = true;
+                game_id = id;
+                c.skip_pos(8);
+                probe_number = -1;
+                probe_alive = false;
+                int number = 0;
+                for (uint32_t parsed = 13; parsed < event_len; number++) {
+                    std::string name = c.read_string(true);
+                    parsed += name.length() + 1;
+                    if (name == PROBE_NAME) {
+                        probe_number = number;
+                        probe_alive = true;
+                    }
+                }
+                pixels = 0;
+                straight.clear();
+                state = probe_number == -1 ? LOBBY : SETTLING;
+                turn_at = clock.now() + PROBE_MIN_SETTLE_USEC +
+                          random() % (PROBE_MAX_SETTLE_USEC - PROBE_MIN_SETTLE_USEC);
+            } else if (type == 1) {
+                int number = c.read_uint8_t();
+                uint32_t x = c.read_uint32_t();
+                uint32_t y = c.read_uint32_t();
+                if (number == probe_number) {
+                    probe_pixel(x, y);
+                }
+            } else if (type == 2) {
+                if (c.read_uint8_t() == probe_number) {
+                    probe_alive = false;
+                    lost += state == TURNING;
+                    state = LOBBY;
+                }
+            } else if (type == 3) {
+                if (state == TURNING) {
+                    lost++;
+                }
+                stranded = probe_alive;
+                active_round = false;
+                next_expected_event_no = 0;
+                state = LOBBY;
+                lobby_step = 0;
+            }
+            c.read_uint32_t();
+        }
+    } catch (CodecError const &e) {
+    }
+}
+
+/* The first pixel places the worm exactly; every rotation is a candidate straight run, and runs that do not
+ * produce the pixels that follow are dropped. While turning, the first pixel no straight run explains is the
+ * first one showing the turn. */
+void Probe::probe_pixel(uint32_t x, uint32_t y) {
+    pixels++;
+    if (pixels == 1) {
+        for (uint32_t rotation = 0; rotation < 360; rotation++) {
+            straight.emplace_back(new Player(Connection(), "", 0, 0, 0));
+            straight.back()->set_new_position(x + 0.5, y + 0.5);
+            straight.back()->set_rotation(rotation);
+        }
+        return;
+    }
+
+    auto explained = [&](std::unique_ptr<Player> &p) {
+        while (!p->move(turning_speed)) {
+        }
+        return floor(p->get_x()) == x && floor(p->get_y()) == y;
+    };
+    straight.erase(std::remove_if(straight.begin(), straight.end(),
+                                  [&](std::unique_ptr<Player> &p) { return !explained(p); }),
+                   straight.end());
+
+    if (straight.empty() && state == TURNING && datagram == 0) {
+        datagram = clock.now();
+        turned_pixel = pixels;
+    } else if (straight.empty() && state == SETTLING) {
+        // The worm turned before the probe pressed a key; this game gives no sample.
+        state = LOBBY;
+    }
+}
+
+/* Counts the PIXEL lines of the probe's worm; the one of the turned pixel completes the sample. The key stays
+ * pressed, so that the worm runs into its own trail and the next game comes sooner. Returns true if a sample was
+ * completed. */
+bool Probe::from_gui() {
+    char buffer[4096];
+    ssize_t len = recv(gui_fd, buffer, sizeof(buffer), 0);
+    if (len <= 0) {
+        std::cerr << "connection with client lost\n";
+        exit(EXIT_FAILURE);
+    }
+    gui_buffer.append(buffer, len);
+
+    size_t end;
+    bool completed = false;
+    while ((end = gui_buffer.find('\n')) != std::string::npos) {
+        std::stringstream line(gui_buffer.substr(0, end));
+        gui_buffer.erase(0, end + 1);
+        std::string command, name;
+        uint32_t x, y;
+        line >> command;
+        if (command == "NEW_GAME") {
+            gui_pixels = 0;
+        } else if (command == "PIXEL" && line >> x >> y >> name && name == PROBE_NAME) {
+            gui_pixels++;
+            if (datagram != 0 && gui_pixels == turned_pixel) {
+                uint64_t now = clock.now();
+                to_heartbeat.record(heartbeat - pressed);
+                in_server.record(datagram - heartbeat);
+                to_gui.record(now - datagram);
+                total.record(now - pressed);
+                datagram = 0;
+                state = LOBBY;
+                completed = true;
+            }
+        }
+    }
+    return completed;
+}
+
+/* Between games the probe makes its worm ready with a short key press, then the companion gets ready too, its
+ * turn taken back at once, so that both start the game going straight. */
+void Probe::lobby(uint64_t now) {
+    if (active_round || now < lobby_step_at) {
+        return;
+    }
+    if (lobby_step == 0) {
+        key("RIGHT_KEY_DOWN\n");
+    } else if (lobby_step == 1) {
+        key("RIGHT_KEY_UP\n");
+    } else if (lobby_step == 2 && companion_fd != -1) {
+        // A new session puts the companion in the lobby even if it won the last game.
+        companion_session++;
+        companion_send(1);
+        companion_send(0);
+    }
+    /* A game that does not start, because a player was not ready after all, is tried again. */
+    lobby_step = (lobby_step + 1) % 4;
+    lobby_step_at = now + (lobby_step == 3 ? PROBE_START_USEC : PROBE_HOLD_USEC);
+}
+
+void Probe::run() {
+    pollfd polls[4];
+    polls[0].fd = gui_fd;
+    polls[1].fd = proxy_fd;
+    polls[2].fd = upstream_fd;
+    polls[3].fd = companion_fd;
+    static char data[MAX_UDP_PAYLOAD];
+
+    clock.update();
+    while (collected < wanted && !stranded) {
+        for (auto &pfd : polls) {
+            pfd.events = POLLIN;
+            pfd.revents = 0;
+        }
+        poll(polls, companion_fd != -1 ? 4 : 3, PROBE_POLL_MSEC);
+        uint64_t now = clock.update();
+
+        if (polls[1].revents & POLLIN) {
+            ssize_t len = recvfrom(proxy_fd, data, sizeof(data), 0, (sockaddr *)client.addr(), client.len_ptr());
+            if (len > 0) {
+                from_client(data, len);
+            }
+        }
+        if (polls[2].revents & POLLIN) {
+            ssize_t len = recv(upstream_fd, data, sizeof(data), 0);
+            if (len > 0) {
+                from_server(data, len);
+            }
+        }
+        if (companion_fd != -1 && (polls[3].revents & POLLIN)) {
+            recv(companion_fd, data, sizeof(data), 0);
+        }
+        if ((polls[0].revents & POLLIN) && from_gui()) {
+            collected++;
+        }
+
+        if (state == SETTLING && now >= turn_at) {
+            state = TURNING;
+            pressed = now;
+            heartbeat = datagram = 0;
+            key("RIGHT_KEY_DOWN\n");
+        }
+        if (companion_fd != -1 && now - companion_heartbeat >= TO_SERVER_TICK) {
+            companion_send(0);
+        }
+        lobby(now);
+    }
+}
+
+/* Starts a binary with arguments, returning its pid. */
+static pid_t start(std::vector<std::string> const &args) {
+    pid_t pid = fork();
+    if (pid == 0) {
+        std::vector<char *> argv;
+        for (auto &arg : args) {
+            argv.push_back((char *)arg.c_str());
+        }
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        std::cerr << "couldn't run " << args[0] << "\n";
+        _exit(EXIT_FAILURE);
+    }
+    if (pid == -1) {
+        std::cerr << "couldn't start " << args[0] << "\n";
+        exit(EXIT_FAILURE);
+    }
+    return pid;
+}
+
+static void stop(pid_t &pid) {
+    if (pid != -1) {
+        kill(pid, SIGTERM);
+        waitpid(pid, nullptr, 0);
+        pid = -1;
+    }
+}
+
+int main(int argc, char *argv[]) {
+    build_crc32_table();
+
+    uint32_t samples = DEFAULT_PROBE_SAMPLES, port = DEFAULT_SERVER_PORT, gui_port = DEFAULT_GUI_PORT;
+    uint32_t proxy_port = DEFAULT_PROXY_PORT, rate = DEFAULT_PROBE_RATE, turning_speed = DEFAULT_PROBE_TURNING_SPEED;
+    std::string host = "localhost", server_binary, client_binary;
+    bool companion = true;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:p:g:P:B:v:t:C:a")) != -1) {
+        if (opt == 'a') {
+            companion = false;
+            continue;
+        } else if (opt == 'B') {
+            server_binary = optarg;
+            continue;
+        } else if (opt == 'C') {
+            client_binary = optarg;
+            continue;
+        } else if (opt == '?') {
+            usage(argv[0]);
+        }
+        uint32_t parsed;
+        try {
+            parsed = string_to_uint32_t(optarg);
+        } catch (UtilityError const &e) {
+            std::cerr << static_cast<char>(opt) << ": " << e.what() << " '" << optarg << "'\n";
+            exit(EXIT_FAILURE);
+        }
+        switch (opt) {
+            case 'n':
+                samples = parsed;
+                break;
+            case 'p':
+                port = parsed;
+                break;
+            case 'g':
+                gui_port = parsed;
+                break;
+            case 'P':
+                proxy_port = parsed;
+                break;
+            case 'v':
+                rate = parsed;
+                break;
+            default:
+                turning_speed = parsed;
+        }
+    }
+    if (argc - optind > 1) {
+        usage(argv[0]);
+    }
+    if (optind < argc) {
+        host = argv[optind];
+    }
+    if (port > MAX_PORT || gui_port > MAX_PORT || proxy_port > MAX_PORT || samples == 0) {
+        std::cerr << "Incorrect port number or sample count\n";
+        exit(EXIT_FAILURE);
+    }
+
+    /* The turning speed has to match the server's, which only holds for a server the probe starts. */
+    pid_t server = -1, client = -1;
+    if (!server_binary.empty()) {
+        server = start({server_binary, "-p", std::to_string(port), "-v", std::to_string(rate), "-t",
+                        std::to_string(turning_speed)});
+        usleep(PROBE_START_USEC);
+    }
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    Probe probe(gui_port, proxy_port, Connection(host.c_str(), port, hints), turning_speed, companion, samples);
+    while (probe.collected < probe.wanted) {
+        stop(client);
+        if (!client_binary.empty()) {
+            client = start({client_binary, "-n", PROBE_NAME, "-p", std::to_string(proxy_port), "-i", "localhost",
+                            "-r", std::to_string(gui_port), "localhost"});
+        } else {
+            std::cout << "waiting for: screen-worms-client -n " << PROBE_NAME << " -p " << proxy_port << " -r "
+                      << gui_port << " localhost\n";
+        }
+        probe.accept_gui();
+        probe.run();
+    }
+
+    stop(client);
+    stop(server);
+
+    std::cout << samples << " samples, " << probe.lost << " lost; milliseconds\n";
+    std::cout << "step\tmin\tp50\tp90\tp99\tmax\n";
+    probe.to_heartbeat.print("key_to_heartbeat");
+    probe.in_server.print("heartbeat_to_pixel");
+    probe.to_gui.print("pixel_to_gui");
+    probe.total.print("key_to_gui");
+}
@@ -0,0 +1,11 @@
+#include "relay.h"
+#include "trace.h"
+#include "utility.h"
+
+int main(int argc, char *argv[]) {
+    build_crc32_table();
+    TRACE_SETUP("screen-worms-relay");
+
+    Relay relay(argc, argv);
+    relay.run();
+}
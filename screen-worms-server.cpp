@@ -1,8 +1,20 @@
+#include "alloc.h"
 #include "server.h"
+#include "trace.h"
+#include "uring_reactor.h"
+
+#include <iostream>
 
 int main(int argc, char *argv[]) {
     build_crc32_table();
-    
+    TRACE_SETUP("screen-worms-server");
+    ALLOC_SETUP();
+
     Server server(argc, argv);
-    server.run();
+    try {
+        server.run();
+    } catch (ReactorError const &e) {
+        std::cerr << e.what() << "\n";
+        return EXIT_FAILURE;
+    }
 }
\ No newline at end of file
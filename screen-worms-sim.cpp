@@ -0,0 +1,204 @@
+#include "clock.h"
+#include "game.h"
+#include "utility.h"
+
+#include <atomic>
+#include <mutex>
+#include <thread>
+
+#define DEFAULT_GAMES 1000
+#define DEFAULT_PLAYERS 2
+#define MAX_PLAYERS 25
+#define DEFAULT_MAX_TICKS 100000
+#define DEFAULT_WIDTH 640
+#define DEFAULT_HEIGHT 480
+#define DEFAULT_TURNING_SPEED 6
+#define TURN_CHANGE_ODDS 8
+
+/* Headless simulator: plays many seeded games on the game engine alone, spread over all cores, as fast as the
+ * engine goes. Turns come from a script of 0/1/2 directions, played by player k with an offset of k, or are
+ * random. The digest over all event logs only changes when the rules do. */
+
+struct Settings {
+    uint32_t games = DEFAULT_GAMES;
+    uint32_t threads = std::max(1u, std::thread::hardware_concurrency());
+    uint32_t players = DEFAULT_PLAYERS;
+    uint32_t maxx = DEFAULT_WIDTH, maxy = DEFAULT_HEIGHT;
+    uint32_t turning_speed = DEFAULT_TURNING_SPEED;
+    uint32_t seed = 1;
+    uint32_t max_ticks = DEFAULT_MAX_TICKS;
+    std::string script;
+};
+
+struct Totals {
+    uint64_t games = 0;
+    uint64_t ticks = 0;
+    uint64_t events = 0;
+    uint64_t memory = 0;
+    uint64_t max_memory = 0;
+    uint64_t digest = 0;
+};
+
+/* Approximate heap used by a finished game: the event log and the set of used pixels. */
+static uint64_t game_memory(Game &game) {
+    uint64_t bytes = game.get_events().capacity() * sizeof(std::shared_ptr<Codec>);
+    for (auto &event : game.get_events()) {
+        // Codec with its buffer, in the block make_shared allocates.
+        bytes += sizeof(Codec) + 2 * sizeof(void *) + event->get_len();
+    }
+    // Red-black tree node: colour and three pointers besides the value.
+    bytes += game.get_used_pixels().size() * (sizeof(std::pair<uint32_t, uint32_t>) + 4 * sizeof(void *));
+    return bytes;
+}
+
+static void play(Settings const &settings, uint32_t seed, Totals &totals) {
+    Game game;
+    game.set_settings(settings.maxx, settings.maxy, settings.turning_speed);
+    game.get_generator().set_seed(seed % Generator::MOD);
+    Generator turns;
+    turns.set_seed((seed * 2654435761u) % Generator::MOD + 1);
+
+    std::list<std::shared_ptr<Player> > players;
+    for (uint32_t i = 0; i < settings.players; i++) {
+        players.push_back(std::make_shared<Player>(Connection(), "p" + std::to_string(i), 0, 0, 0));
+    }
+    std::vector<std::shared_ptr<Player> > all(players.begin(), players.end());
+    game.start(players);
+
+    std::list<std::shared_ptr<Player> > eliminated;
+    uint64_t ticks = 0;
+    while (game.is_active() && ticks < settings.max_ticks) {
+        for (size_t k = 0; k < all.size(); k++) {
+            if (!settings.script.empty()) {
+                all[k]->set_turn_direction(settings.script[(ticks + k) % settings.script.length()] - '0');
+            } else {
+                uint32_t r = turns.next();
+                if (r % TURN_CHANGE_ODDS == 0) {
+                    all[k]->set_turn_direction(r / TURN_CHANGE_ODDS % 3);
+                }
+            }
+        }
+        game.tick(eliminated);
+        ticks++;
+    }
+
+    uint64_t digest = 14695981039346656037ULL;
+    for (auto &event : game.get_events()) {
+        for (size_t i = 0; i < event->get_len(); i++) {
+            digest = (digest ^ (unsigned char)event->get_data()[i]) * 1099511628211ULL;
+        }
+    }
+
+    uint64_t memory = game_memory(game);
+    totals.games++;
+    totals.ticks += ticks;
+    totals.events += game.get_events().size();
+    totals.memory += memory;
+    totals.max_memory = std::max(totals.max_memory, memory);
+    totals.digest += digest;
+}
+
+static void usage(char const *name) {
+    std::cerr << "Usage " << name << " [-g games] [-j threads] [-n players] [-w n] [-h n] [-t n] [-s seed]"
+              << " [-x max_ticks] [-S script]\n";
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    build_crc32_table();
+
+    Settings settings;
+    int opt;
+    while ((opt = getopt(argc, argv, "g:j:n:w:h:t:s:x:S:")) != -1) {
+        if (opt == '?') {
+            usage(argv[0]);
+        }
+        if (opt == 'S') {
+            settings.script = optarg;
+            if (settings.script.find_first_not_of("012") != std::string::npos) {
+                std::cerr << "Script should only have turn directions 0, 1 and 2\n";
+                exit(EXIT_FAILURE);
+            }
+            continue;
+        }
+        uint32_t parsed;
+        try {
+            parsed = string_to_uint32_t(optarg);
+        } catch (UtilityError const &e) {
+            std::cerr << static_cast<char>(opt) << ": " << e.what() << " '" << optarg << "'\n";
+            exit(EXIT_FAILURE);
+        }
+        switch (opt) {
+            case 'g':
+                settings.games = parsed;
+                break;
+            case 'j':
+                settings.threads = parsed;
+                break;
+            case 'n':
+                settings.players = parsed;
+                break;
+            case 'w':
+                settings.maxx = parsed;
+                break;
+            case 'h':
+                settings.maxy = parsed;
+                break;
+            case 't':
+                settings.turning_speed = parsed;
+                break;
+            case 's':
+                settings.seed = parsed;
+                break;
+            case 'x':
+                settings.max_ticks = parsed;
+                break;
+            default:
+                usage(argv[0]);
+        }
+    }
+    if (optind < argc) {
+        usage(argv[0]);
+    }
+    if (settings.players < 2 || settings.players > MAX_PLAYERS || settings.threads == 0 || settings.maxx == 0 ||
+        settings.maxy == 0 || settings.turning_speed == 0 || settings.turning_speed >= 360) {
+        std::cerr << "Incorrect settings\n";
+        exit(EXIT_FAILURE);
+    }
+
+    std::atomic<uint32_t> next_game(0);
+    std::mutex totals_mutex;
+    Totals totals;
+    MonotonicClock clock;
+    uint64_t start = clock.update();
+
+    std::vector<std::thread> workers;
+    for (uint32_t t = 0; t < settings.threads; t++) {
+        workers.emplace_back([&]() {
+            Totals mine;
+            for (uint32_t i = next_game++; i < settings.games; i = next_game++) {
+                play(settings, settings.seed + i, mine);
+            }
+            std::lock_guard<std::mutex> lock(totals_mutex);
+            totals.games += mine.games;
+            totals.ticks += mine.ticks;
+            totals.events += mine.events;
+            totals.memory += mine.memory;
+            totals.max_memory = std::max(totals.max_memory, mine.max_memory);
+            totals.digest += mine.digest;
+        });
+    }
+    for (auto &worker : workers) {
+        worker.join();
+    }
+
+    uint64_t usec = std::max<uint64_t>(1, clock.update() - start);
+    std::cout << "games\t" << totals.games << " on " << settings.threads << " threads in " << usec / 1000 << " ms\n";
+    std::cout << "ticks\t" << totals.ticks << "\t" << totals.ticks * 1000000 / usec << " ticks/s\n";
+    std::cout << "events\t" << totals.events << "\t" << totals.events * 1000000 / usec << " events/s\n";
+    if (totals.games > 0) {
+        std::cout << "memory\t" << totals.memory / totals.games << " bytes/game\t" << totals.max_memory
+                  << " bytes max\n";
+    }
+    std::cout << "digest\t" << std::hex << totals.digest << std::dec << "\n";
+}
@@ -0,0 +1,91 @@
+#include "metrics.h"
+
+#include <iostream>
+#include <unistd.h>
+
+/* Prints the metrics a server (started with -S name) keeps in shared memory, as a table or, with -P, in the
+ * Prometheus text exposition format. Durations are exported in seconds, as Prometheus expects. */
+
+static uint64_t get(std::atomic<uint64_t> const &value) {
+    return value.load(std::memory_order_relaxed);
+}
+
+static void print_table(MetricsSegment const &m) {
+    std::cout << "pid\t" << m.pid << "\n";
+    for (int i = 0; i < COUNTERS; i++) {
+        std::cout << METRICS_COUNTER_NAMES[i][0] << "\t" << get(m.counters[i]) << "\n";
+    }
+    for (int i = 0; i < GAUGES; i++) {
+        std::cout << METRICS_GAUGE_NAMES[i][0] << "\t" << get(m.gauges[i]) << "\n";
+    }
+    for (int i = 0; i < HISTOGRAMS; i++) {
+        MetricsHistogramData const &h = m.histograms[i];
+        uint64_t count = get(h.count);
+        std::cout << METRICS_HISTOGRAM_NAMES[i][0] << "\t" << count << " samples, mean "
+                  << (count == 0 ? 0 : get(h.sum) / count) << "us, below";
+        for (int b = 0; b < METRICS_BUCKETS; b++) {
+            if (get(h.buckets[b]) != 0) {
+                std::cout << " " << (1u << b) << "us:" << get(h.buckets[b]);
+            }
+        }
+        std::cout << "\n";
+    }
+}
+
+static void print_prometheus(MetricsSegment const &m) {
+    for (int i = 0; i < COUNTERS; i++) {
+        std::string name = std::string("screen_worms_") + METRICS_COUNTER_NAMES[i][0] + "_total";
+        std::cout << "# HELP " << name << " " << METRICS_COUNTER_NAMES[i][1] << "\n";
+        std::cout << "# TYPE " << name << " counter\n";
+        std::cout << name << " " << get(m.counters[i]) << "\n";
+    }
+    for (int i = 0; i < GAUGES; i++) {
+        std::string name = std::string("screen_worms_") + METRICS_GAUGE_NAMES[i][0];
+        std::cout << "# HELP " << name << " " << METRICS_GAUGE_NAMES[i][1] << "\n";
+        std::cout << "# TYPE " << name << " gauge\n";
+        std::cout << name << " " << get(m.gauges[i]) << "\n";
+    }
+    for (int i = 0; i < HISTOGRAMS; i++) {
+        MetricsHistogramData const &h = m.histograms[i];
+        std::string name = std::string("screen_worms_") + METRICS_HISTOGRAM_NAMES[i][0] + "_seconds";
+        std::cout << "# HELP " << name << " " << METRICS_HISTOGRAM_NAMES[i][1] << "\n";
+        std::cout << "# TYPE " << name << " histogram\n";
+        uint64_t cumulative = 0;
+        for (int b = 0; b < METRICS_BUCKETS - 1; b++) {
+            cumulative += get(h.buckets[b]);
+            std::cout << name << "_bucket{le=\"" << (1u << b) / 1e6 << "\"} " << cumulative << "\n";
+        }
+        cumulative += get(h.buckets[METRICS_BUCKETS - 1]);
+        std::cout << name << "_bucket{le=\"+Inf\"} " << cumulative << "\n";
+        std::cout << name << "_sum " << get(h.sum) / 1e6 << "\n";
+        std::cout << name << "_count " << cumulative << "\n";
+    }
+}
+
+int main(int argc, char *argv[]) {
+    bool prometheus = false;
+    int opt;
+    while ((opt = getopt(argc, argv, "P")) != -1) {
+        if (opt == 'P') {
+            prometheus = true;
+        } else {
+            std::cerr << "Usage " << argv[0] << " [-P] name\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (argc - optind != 1) {
+        std::cerr << "Usage " << argv[0] << " [-P] name\n";
+        exit(EXIT_FAILURE);
+    }
+
+    MetricsSegment const *metrics = open_metrics(argv[optind]);
+    if (metrics == nullptr) {
+        std::cerr << "no metrics segment " << argv[optind] << "\n";
+        exit(EXIT_FAILURE);
+    }
+    if (prometheus) {
+        print_prometheus(*metrics);
+    } else {
+        print_table(*metrics);
+    }
+}
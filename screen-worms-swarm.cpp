@@ -0,0 +1,473 @@
+#include "clock.h"
+#include "codec.h"
+#include "connection.h"
+#include "metrics.h"
+#include "protocol.h"
+#include "reactor.h"
+#include "utility.h"
+
+#include <algorithm>
+#include <csignal>
+#include <cstring>
+#include <map>
+#include <random>
+#include <sys/mman.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+
+#define DEFAULT_SERVER_PORT 2021
+#define MAX_PORT 65535
+
+#define DEFAULT_SWARM_SECONDS 10
+#define SWARM_MAX_PLAYERS 64 // names of more players do not fit the NEW_GAME event in a default datagram
+#define SWARM_TURN_USEC 100000 // a turn of the script, and the shortest random turn
+#define SWARM_SERVER_START_USEC 300000
+#define LATENCY_BUCKET_USEC 10
+#define LATENCY_BUCKETS 100000 // up to a second
+
+/* Load generator: plays N players and M observers against a server from a single process. Every bot has its own
+ * UDP socket and speaks the real protocol: heartbeats every 30 ms, events checked for their crc and accepted in
+ * order only. Reported are the tick rate the server held during games, how late each bot got events compared
+ * with the first bot that got them, gaps, duplicates and traffic per client.
+ *
+ * With lists of players, observers and rates and a server binary (-B), every combination is run against a fresh
+ * server, giving one line of a scalability curve per point. */
+
+/* Delivery latencies with LATENCY_BUCKET_USEC buckets; longer ones share the last bucket. */
+class LatencyHistogram {
+private:
+    std::vector<uint64_t> counts;
+    uint64_t samples = 0;
+
+public:
+    LatencyHistogram() : counts(LATENCY_BUCKETS, 0) {}
+
+    void record(uint64_t usec) {
+        counts[std::min<uint64_t>(usec / LATENCY_BUCKET_USEC, LATENCY_BUCKETS - 1)]++;
+        samples++;
+    }
+
+    uint64_t percentile(double fraction) const {
+        uint64_t seen = 0;
+        for (size_t i = 0; i < counts.size(); i++) {
+            seen += counts[i];
+            if (seen > fraction * samples) {
+                return i * LATENCY_BUCKET_USEC;
+            }
+        }
+        return (counts.size() - 1) * LATENCY_BUCKET_USEC;
+    }
+};
+
+struct Bot {
+    int fd;
+    uint64_t session_id;
+    std::string name;
+    uint8_t turn_direction = 0;
+    uint64_t next_turn = 0;
+    bool active_round = false;
+    uint32_t game_id = 0;
+    uint32_t next_expected_event_no = 0;
+};
+
+/* Events of a game as first seen by any bot, the reference for delivery latency. */
+struct GameTrack {
+    std::vector<uint64_t> first_seen;
+    uint64_t started = 0;
+    bool over = false;
+};
+
+struct SwarmStats {
+    uint64_t events = 0;
+    uint64_t gaps = 0;
+    uint64_t duplicates = 0;
+    uint64_t crc_errors = 0;
+    uint64_t bytes_in = 0;
+    uint64_t bytes_out = 0;
+    uint64_t games = 0;
+    uint64_t game_usec = 0;
+    LatencyHistogram latency;
+};
+
+/* Settings of the whole run; players, observers and the rate vary between points of a sweep. */
+struct SwarmSettings {
+    std::string host = "localhost";
+    uint32_t port = DEFAULT_SERVER_PORT;
+    uint32_t seconds = DEFAULT_SWARM_SECONDS;
+    std::string script;
+    bool realtime_observers = false;
+    std::string server_binary;
+    std::string metrics_name;
+};
+
+class Swarm {
+private:
+    SwarmSettings const &settings;
+    std::vector<Bot> bots;
+    std::vector<int> bot_of_fd;
+    std::unique_ptr<Reactor> reactor;
+    std::map<uint32_t, GameTrack> games;
+    MonotonicClock clock;
+    std::mt19937 random;
+    SwarmStats stats;
+
+    void send_heartbeat(Bot &bot);
+    void turn(Bot &bot, size_t index, uint64_t now);
+    void process_datagram(Bot &bot, Codec &c, ssize_t len, uint64_t now);
+
+public:
+    Swarm(SwarmSettings const &settings, uint32_t players, uint32_t observers, uint32_t seed);
+    ~Swarm();
+
+    /* Runs for the configured time and returns what was measured. */
+    SwarmStats const &run();
+};
+
+Swarm::Swarm(SwarmSettings const &settings, uint32_t players, uint32_t observers, uint32_t seed)
+    : settings(settings), random(seed) {
+    reactor.reset(new PollReactor(MAX_DATAGRAM_SIZE));
+
+    addrinfo hints = {};
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_DGRAM;
+    Connection server(settings.host.c_str(), settings.port, hints);
+
+    uint64_t session_id = clock.update();
+    for (uint32_t i = 0; i < players + observers; i++) {
+        Bot bot;
+        bot.fd = socket(server.get_family(), SOCK_DGRAM | SOCK_NONBLOCK, 0);
+        if (bot.fd == -1 || connect(bot.fd, (sockaddr *)server.addr(), server.len()) == -1) {
+            std::cerr << "couldn't create socket for bot " << i << "\n";
+            exit(EXIT_FAILURE);
+        }
+        bot.session_id = session_id + i;
+        if (i < players) {
+            bot.name = "bot" + std::to_string(i);
+        }
+        if ((size_t)bot.fd >= bot_of_fd.size()) {
+            bot_of_fd.resize(bot.fd + 1, -1);
+        }
+        bot_of_fd[bot.fd] = bots.size();
+        reactor->add_socket(bot.fd);
+        bots.push_back(bot);
+    }
+}
+
+Swarm::~Swarm() {
+    for (auto &bot : bots) {
+        reactor->remove_socket(bot.fd);
+        close(bot.fd);
+    }
+}
+
+void Swarm::send_heartbeat(Bot &bot) {
+    Codec c;
+    c.add_uint64_t(bot.session_id);
+    c.add_uint8_t(bot.turn_direction);
+    c.add_uint32_t(bot.next_expected_event_no);
+    c.add_string(bot.name, false);
+    if (bot.name.empty() && settings.realtime_observers) {
+        c.add_uint8_t(0);
+        c.add_uint32_t(MAX_DATAGRAM_SIZE);
+        c.add_uint8_t(REALTIME_UPDATES);
+    }
+    if (send(bot.fd, c.get_data(), c.get_len(), 0) > 0) {
+        stats.bytes_out += c.get_len();
+    }
+}
+
+/* Players follow the script, each starting at its own place in it, or turn at random for random periods.
+ * A player turns at least once in a while, which is what makes it ready for the next game. */
+void Swarm::turn(Bot &bot, size_t index, uint64_t now) {
+    if (bot.name.empty() || now < bot.next_turn) {
+        return;
+    }
+    if (!settings.script.empty()) {
+        size_t step = (now / SWARM_TURN_USEC + index) % settings.script.size();
+        bot.turn_direction = settings.script[step] - '0';
+        bot.next_turn = (now / SWARM_TURN_USEC + 1) * SWARM_TURN_USEC;
+    } else {
+        bot.turn_direction = random() % 3;
+        bot.next_turn = now + SWARM_TURN_USEC * (1 + random() % 10);
+    }
+}
+
+/* Accepts events the way the client does: only the one the bot expects next, of the game it plays. */
+void Swarm::process_datagram(Bot &bot, Codec &c, ssize_t len, uint64_t now) {
+    stats.bytes_in += len;
+    c.trim(len);
+    try {
+        uint32_t game_id = c.read_uint32_t();
+        if ((bot.active_round && game_id != bot.game_id) || (!bot.active_round && game_id == bot.game_id)) {
+            return;
+        }
+        while (c.has_data()) {
+            uint32_t event_len = c.read_uint32_t();
+            if (event_len < 5 || event_len + 4 > c.get_remaining()) {
+                stats.crc_errors++;
+                return;
+            }
+            if (!check_crc32((char *)c.get_pos() - 4, event_len + 4, c.read_crc(event_len))) {
+                stats.crc_errors++;
+                return;
+            }
+            uint32_t event_no = c.read_uint32_t();
+            uint8_t type = c.read_uint8_t();
+            c.skip_pos(event_len - 5);
+            c.read_uint32_t();
+
+            if (event_no < bot.next_expected_event_no) {
+                stats.duplicates++;
+                continue;
+            }
+            if (event_no > bot.next_expected_event_no) {
+                stats.gaps++;
+                return;
+            }
+            if (!bot.active_round && (type != 0 || event_no != 0)) {
+                return;
+            }
+
+            GameTrack &track = games[game_id];
+            if (type == 0) {
+                bot.active_round = true;
+                bot.game_id = game_id;
+                if (track.started == 0) {
+                    track.started = now;
+                    stats.games++;
+                }
+            }
+            if (track.first_seen.size() <= event_no) {
+                track.first_seen.resize(event_no + 1, 0);
+            }
+            if (track.first_seen[event_no] == 0) {
+                track.first_seen[event_no] = now;
+            }
+            stats.latency.record(now - track.first_seen[event_no]);
+            stats.events++;
+            bot.next_expected_event_no++;
+
+            if (type == 3) {
+                bot.active_round = false;
+                bot.next_expected_event_no = 0;
+                if (!track.over) {
+                    track.over = true;
+                    stats.game_usec += now - track.started;
+                }
+                return;
+            }
+        }
+    } catch (CodecError const &e) {
+        stats.crc_errors++;
+    }
+}
+
+SwarmStats const &Swarm::run() {
+    std::vector<ReceivedDatagram> received;
+    uint64_t start = clock.update();
+    uint64_t end = start + (uint64_t)settings.seconds * 1000000;
+
+    /* Heartbeats are spread evenly over the 30 ms period, bot after bot. */
+    size_t cursor = 0;
+    uint64_t round_start = start;
+    while (clock.now() < end) {
+        uint64_t now = clock.now();
+        uint64_t due = round_start + TO_SERVER_TICK * cursor / bots.size();
+        while (due <= now) {
+            turn(bots[cursor], cursor, now);
+            send_heartbeat(bots[cursor]);
+            if (++cursor == bots.size()) {
+                cursor = 0;
+                round_start += TO_SERVER_TICK;
+            }
+            due = round_start + TO_SERVER_TICK * cursor / bots.size();
+        }
+
+        received.clear();
+        reactor->wait(due - now, false, received);
+        now = clock.update();
+        for (auto &datagram : received) {
+            if ((size_t)datagram.fd < bot_of_fd.size() && bot_of_fd[datagram.fd] != -1) {
+                process_datagram(bots[bot_of_fd[datagram.fd]], datagram.data, datagram.len, now);
+            }
+        }
+    }
+
+    /* A game still going counts until the end of the run. */
+    for (auto &game : games) {
+        if (!game.second.over) {
+            stats.game_usec += clock.now() - game.second.started;
+        }
+    }
+    return stats;
+}
+
+static std::vector<uint32_t> parse_list(char opt, char const *list) {
+    std::vector<uint32_t> values;
+    std::stringstream ss(list);
+    std::string item;
+    while (std::getline(ss, item, ',')) {
+        try {
+            values.push_back(string_to_uint32_t(item));
+        } catch (UtilityError const &e) {
+            std::cerr << opt << ": " << e.what() << " '" << item << "'\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (values.empty()) {
+        std::cerr << opt << ": empty list\n";
+        exit(EXIT_FAILURE);
+    }
+    return values;
+}
+
+/* Starts the server binary on the port with the rate, keeping its metrics in the named segment. */
+static pid_t start_server(SwarmSettings const &settings, uint32_t rate) {
+    std::string port = std::to_string(settings.port), rounds = std::to_string(rate);
+    pid_t pid = fork();
+    if (pid == 0) {
+        execl(settings.server_binary.c_str(), settings.server_binary.c_str(), "-p", port.c_str(), "-v",
+              rounds.c_str(), "-S", settings.metrics_name.c_str(), (char *)nullptr);
+        std::cerr << "couldn't run " << settings.server_binary << "\n";
+        _exit(EXIT_FAILURE);
+    }
+    if (pid == -1) {
+        std::cerr << "couldn't start server\n";
+        exit(EXIT_FAILURE);
+    }
+    usleep(SWARM_SERVER_START_USEC);
+    return pid;
+}
+
+static uint64_t ticks_so_far(SwarmSettings const &settings) {
+    MetricsSegment const *metrics = settings.metrics_name.empty() ? nullptr : open_metrics(settings.metrics_name);
+    if (metrics == nullptr) {
+        return 0;
+    }
+    uint64_t ticks = metrics->counters[TICKS].load(std::memory_order_relaxed);
+    munmap((void *)metrics, sizeof(MetricsSegment));
+    return ticks;
+}
+
+static void usage(char const *name) {
+    std::cerr << "Usage " << name << " [-n players,...] [-o observers,...] [-v rate,...] [-t seconds] [-p port]"
+              << " [-T script] [-s seed] [-B server_binary] [-S metrics] [-l] [host]\n";
+    exit(EXIT_FAILURE);
+}
+
+int main(int argc, char *argv[]) {
+    build_crc32_table();
+
+    SwarmSettings settings;
+    std::vector<uint32_t> players{2}, observers{0}, rates{50};
+    uint32_t seed = 1;
+    int opt;
+    while ((opt = getopt(argc, argv, "n:o:v:t:p:T:s:B:S:l")) != -1) {
+        if (opt == 'n') {
+            players = parse_list(opt, optarg);
+        } else if (opt == 'o') {
+            observers = parse_list(opt, optarg);
+        } else if (opt == 'v') {
+            rates = parse_list(opt, optarg);
+        } else if (opt == 't') {
+            settings.seconds = parse_list(opt, optarg)[0];
+        } else if (opt == 'p') {
+            settings.port = parse_list(opt, optarg)[0];
+        } else if (opt == 's') {
+            seed = parse_list(opt, optarg)[0];
+        } else if (opt == 'T') {
+            settings.script = optarg;
+        } else if (opt == 'B') {
+            settings.server_binary = optarg;
+        } else if (opt == 'S') {
+            settings.metrics_name = optarg;
+        } else if (opt == 'l') {
+            settings.realtime_observers = true;
+        } else {
+            usage(argv[0]);
+        }
+    }
+    if (argc - optind > 1) {
+        usage(argv[0]);
+    }
+    if (optind < argc) {
+        settings.host = argv[optind];
+    }
+
+    if (settings.port > MAX_PORT || settings.seconds == 0) {
+        std::cerr << "Incorrect port number or duration\n";
+        exit(EXIT_FAILURE);
+    }
+    if (settings.script.find_first_not_of("012") != std::string::npos) {
+        std::cerr << "Script should consist of turn directions 0, 1 and 2\n";
+        exit(EXIT_FAILURE);
+    }
+    uint32_t most_clients = 0;
+    for (uint32_t p : players) {
+        if (p > SWARM_MAX_PLAYERS) {
+            std::cerr << "At most " << SWARM_MAX_PLAYERS << " players\n";
+            exit(EXIT_FAILURE);
+        }
+        for (uint32_t o : observers) {
+            most_clients = std::max(most_clients, p + o);
+        }
+    }
+    if (most_clients == 0) {
+        std::cerr << "No clients to simulate\n";
+        exit(EXIT_FAILURE);
+    }
+    if (settings.server_binary.empty() && (players.size() > 1 || observers.size() > 1 || rates.size() > 1)) {
+        std::cerr << "A sweep starts its own servers and needs -B\n";
+        exit(EXIT_FAILURE);
+    }
+    if (!settings.server_binary.empty() && settings.metrics_name.empty()) {
+        settings.metrics_name = "/screen-worms-swarm-" + std::to_string(getpid());
+    }
+
+    /* Every bot needs a socket. */
+    rlimit files;
+    getrlimit(RLIMIT_NOFILE, &files);
+    files.rlim_cur = files.rlim_max;
+    setrlimit(RLIMIT_NOFILE, &files);
+    if (most_clients + 64 > files.rlim_cur) {
+        std::cerr << "At most " << files.rlim_cur - 64 << " clients fit the open file limit\n";
+        exit(EXIT_FAILURE);
+    }
+
+    std::cout << "players\tobservers\trate\tticks/s\tgames\tevents\tp50_us\tp99_us\tp999_us\tgaps\tdups\tcrc\t"
+                 "in_B/s/client\tout_B/s/client\n";
+    for (uint32_t rate : rates) {
+        for (uint32_t p : players) {
+            for (uint32_t o : observers) {
+                pid_t server = settings.server_binary.empty() ? -1 : start_server(settings, rate);
+                uint64_t ticks = ticks_so_far(settings);
+                SwarmStats stats;
+                {
+                    Swarm swarm(settings, p, o, seed);
+                    stats = swarm.run();
+                }
+                ticks = ticks_so_far(settings) - ticks;
+                if (server != -1) {
+                    kill(server, SIGTERM);
+                    waitpid(server, nullptr, 0);
+                }
+
+                double clients = p + o;
+                std::cout << p << "\t" << o << "\t" << rate << "\t";
+                if (settings.metrics_name.empty() || stats.game_usec == 0) {
+                    std::cout << "-";
+                } else {
+                    std::cout << ticks * 1e6 / stats.game_usec;
+                }
+                std::cout << "\t" << stats.games << "\t" << stats.events << "\t" << stats.latency.percentile(0.5)
+                          << "\t" << stats.latency.percentile(0.99) << "\t" << stats.latency.percentile(0.999) << "\t"
+                          << stats.gaps << "\t" << stats.duplicates << "\t" << stats.crc_errors << "\t"
+                          << (uint64_t)(stats.bytes_in / clients / settings.seconds) << "\t"
+                          << (uint64_t)(stats.bytes_out / clients / settings.seconds) << "\n";
+            }
+        }
+    }
+    if (!settings.server_binary.empty()) {
+        shm_unlink(settings.metrics_name.c_str());
+    }
+}
@@ -1,15 +1,73 @@
 #include "server.h"
+#include "alloc.h"
+#include "trace.h"
+#include "uring_reactor.h"
 
 #include <fcntl.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#include <netinet/udp.h>
 
-Server::Server(int argc, char *argv[]) {
+static volatile sig_atomic_t capture_requested = 0;
+
+static void request_capture(int) {
+    capture_requested = 1;
+}
+
+static void usage(char const *name) {
+    std::cerr << "Usage " << name << " [-p n] [-s n] [-t n] [-v n] [-w n] [-h n] [-d n] [-m group] [-M n]"
+              << " [-b n] [-B n] [-r cpu] [-H path] [-A path] [-a path] [-R path] [-x n]"
+              << " [-C path] [-S name] [-c] [-u] [-f] [-F]\n";
+    exit(EXIT_FAILURE);
+}
+
+Server::Server(int argc, char *argv[], std::unique_ptr<Clock> clock) : clock(std::move(clock)) {
     /* Parsing arguments */
-    uint32_t port = DEFAULT_PORT, seed = static_cast<uint32_t>(time(NULL) % Generator::MOD);
+    uint32_t seed = static_cast<uint32_t>(time(NULL) % Generator::MOD);
+    uint32_t maxx = DEFAULT_WIDTH, maxy = DEFAULT_HEIGHT;
+    uint32_t turning_speed = DEFAULT_TURNING_SPEED;
+    uint32_t multicast_port = DEFAULT_MULTICAST_PORT;
+    std::string group;
+    std::string adopt_path;
+    std::string archive_path, replay_path;
+    std::string metrics_name;
     int opt;
-    while ((opt = getopt(argc, argv, "p:s:t:v:w:h:")) != -1) {
+    while ((opt = getopt(argc, argv, "p:s:t:v:w:h:d:m:M:b:B:r:H:A:a:R:x:C:S:cufF")) != -1) {
         uint32_t parsed;
+        if (opt == 'c') {
+            connected_sockets = true;
+            continue;
+        } else if (opt == 'u') {
+            use_uring = true;
+            continue;
+        } else if (opt == 'f') {
+            length_filter = true;
+            continue;
+        } else if (opt == 'F') {
+            realtime_fifo = true;
+            continue;
+        } else if (opt == 'm' && optarg != NULL) {
+            group = optarg;
+            continue;
+        } else if (opt == 'H' && optarg != NULL) {
+            handoff_path = optarg;
+            continue;
+        } else if (opt == 'A' && optarg != NULL) {
+            adopt_path = optarg;
+            continue;
+        } else if (opt == 'a' && optarg != NULL) {
+            archive_path = optarg;
+            continue;
+        } else if (opt == 'R' && optarg != NULL) {
+            replay_path = optarg;
+            continue;
+        } else if (opt == 'C' && optarg != NULL) {
+            capture_path = optarg;
+            continue;
+        } else if (opt == 'S' && optarg != NULL) {
+            metrics_name = optarg;
+            continue;
+        }
         if (optarg == NULL) {
             std::cerr << "No argument given\n";
             exit(EXIT_FAILURE);
@@ -39,21 +97,38 @@ Server::Server(int argc, char *argv[]) {
             case 'h':
                 maxy = parsed;
                 break;
+            case 'd':
+                max_datagram_size = parsed;
+                break;
+            case 'M':
+                multicast_port = parsed;
+                break;
+            case 'b':
+                batch_ticks = parsed;
+                break;
+            case 'B':
+                batch_msec = parsed;
+                break;
+            case 'r':
+                realtime = true;
+                realtime_cpu = parsed;
+                break;
+            case 'x':
+                replay_speed = parsed;
+                break;
             default:
-                std::cerr << "Usage " << argv[0] << " [-p n] [-s n] [-t n] [-v n] [-w n] [-h n]\n";
-                exit(EXIT_FAILURE);
+                usage(argv[0]);
                 break;
         }
     }
 
     if (optind < argc) {
-        std::cerr << "Usage " << argv[0] << " [-p n] [-s n] [-t n] [-v n] [-w n] [-h n]\n";
-        exit(EXIT_FAILURE);
+        usage(argv[0]);
     }
 
     /* Purpose specific validation of arguments */
 
-    if (port > MAX_PORT) {
+    if (port > MAX_PORT || multicast_port > MAX_PORT) {
         std::cerr << "Incorrect port number\n";
         exit(EXIT_FAILURE);
     }
@@ -73,115 +148,337 @@ Server::Server(int argc, char *argv[]) {
         exit(EXIT_FAILURE);
     }
 
-    gen.set_seed(seed);
+    if (max_datagram_size < MAX_DATAGRAM_SIZE || max_datagram_size > MAX_UDP_PAYLOAD) {
+        std::cerr << "Datagram size should be in [" << MAX_DATAGRAM_SIZE << ", " << MAX_UDP_PAYLOAD << "] range\n";
+        exit(EXIT_FAILURE);
+    }
 
-    /* Setting up connections. */
-    fd = socket(AF_INET6, SOCK_DGRAM, 0);
-    if (fd == -1) {
-        std::cout << "couldn't create socket\n";
+    if (replay_speed == 0 || replay_speed > MAX_REPLAY_SPEED) {
+        std::cerr << "Replay speed should be in [1, " << MAX_REPLAY_SPEED << "] range\n";
         exit(EXIT_FAILURE);
     }
 
-    sockaddr_in6 ip;
-    memset(&ip, 0, sizeof(sockaddr_in6));
-    ip.sin6_family = AF_INET6;
-    ip.sin6_port = htobe16(port);
-    ip.sin6_addr = in6addr_any;
+    /* Finished games are appended to the archive; in replay mode archived games are served instead of played. */
+    if (!archive_path.empty()) {
+        archive_fd = open(archive_path.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+        if (archive_fd == -1) {
+            std::cerr << "couldn't open archive " << archive_path << "\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+    if (!replay_path.empty()) {
+        try {
+            replay.reset(new Archive(replay_path));
+        } catch (ArchiveError const &e) {
+            std::cerr << replay_path << ": " << e.what() << "\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    /* The last inbound datagrams are kept in memory and written to the capture file on SIGUSR1. */
+    if (!capture_path.empty()) {
+        capture.reset(new CaptureRing());
+        struct sigaction action;
+        memset(&action, 0, sizeof(action));
+        action.sa_handler = request_capture;
+        sigemptyset(&action.sa_mask);
+        sigaction(SIGUSR1, &action, nullptr);
+    }
+
+    /* Metrics are always kept; in a shared memory segment they can be read by screen-worms-stat. */
+    if (!metrics_name.empty() && !metrics.share(metrics_name)) {
+        std::cerr << "couldn't create metrics segment " << metrics_name << "\n";
+        exit(EXIT_FAILURE);
+    }
 
-    if (bind(fd, (sockaddr *)&ip, sizeof(ip)) < 0) {
-        std::cout << "cannot bind on port \n";
+    if (realtime_fifo && !realtime) {
+        std::cerr << "SCHED_FIFO needs real-time mode (-r cpu)\n";
         exit(EXIT_FAILURE);
     }
 
-    polls[0].fd = fd;
-    polls[0].events = POLLIN | POLLERR;
-    polls[0].revents = 0;
+    if (batch_ticks == 0 || batch_ticks > MAX_BATCH_TICKS || batch_msec > MAX_BATCH_MSEC) {
+        std::cerr << "Observer batches should be every [1, " << MAX_BATCH_TICKS << "] ticks and at most "
+                  << MAX_BATCH_MSEC << " ms\n";
+        exit(EXIT_FAILURE);
+    }
+
+    game.set_settings(maxx, maxy, turning_speed);
+    game.get_generator().set_seed(seed);
+    governor.set_budget(SEC_TO_USEC / rounds_per_sec);
+
+    /* Setting up connections. Taking over from a running server gets its bound socket instead. */
+    Codec image;
+    int handoff_conn = -1;
+    if (!adopt_path.empty()) {
+        fd = receive_handoff(adopt_path, image, handoff_conn);
+        if (fd == -1) {
+            std::cerr << "couldn't take over from " << adopt_path << "\n";
+            exit(EXIT_FAILURE);
+        }
+    } else {
+        fd = socket(AF_INET6, SOCK_DGRAM, 0);
+        if (fd == -1) {
+            std::cout << "couldn't create socket\n";
+            exit(EXIT_FAILURE);
+        }
+
+        sockaddr_in6 ip;
+        memset(&ip, 0, sizeof(sockaddr_in6));
+        ip.sin6_family = AF_INET6;
+        ip.sin6_port = htobe16(port);
+        ip.sin6_addr = in6addr_any;
+
+        /* Per-client connected sockets share the server port with the main one. */
+        int flag = 1;
+        if (connected_sockets && setsockopt(fd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag)) == -1) {
+            std::cout << "couldn't set SO_REUSEPORT\n";
+            exit(EXIT_FAILURE);
+        }
+
+        if (bind(fd, (sockaddr *)&ip, sizeof(ip)) < 0) {
+            std::cerr << "cannot bind on port " << port << ": " << strerror(errno) << "\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (length_filter && !attach_length_filter(fd, MIN_HEARTBEAT_LEN, MAX_HEARTBEAT_LEN)) {
+        std::cout << "couldn't attach socket filter\n";
+        exit(EXIT_FAILURE);
+    }
+    // Without receive timestamps the time spent queued in the socket is not measured.
+    enable_receive_timestamps(fd);
+
+    /* Live events for subscribed observers go once to the multicast group. A scope id in the group address
+     * ("ff02::1%eth0") picks the interface; looped back copies let observers on this host subscribe too. */
+    if (!group.empty()) {
+        addrinfo hints = {};
+        hints.ai_family = AF_INET6;
+        hints.ai_socktype = SOCK_DGRAM;
+        hints.ai_flags = AI_NUMERICHOST;
+        multicast_group = Connection(group.c_str(), multicast_port, hints);
+        sockaddr_in6 *group_ip = (sockaddr_in6 *)multicast_group.addr();
+        if (!IN6_IS_ADDR_MULTICAST(&group_ip->sin6_addr)) {
+            std::cerr << "Incorrect multicast group\n";
+            exit(EXIT_FAILURE);
+        }
+        unsigned interface = group_ip->sin6_scope_id;
+        int loop = 1;
+        if ((interface != 0 && setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_IF, &interface, sizeof(interface)) == -1) ||
+            setsockopt(fd, IPPROTO_IPV6, IPV6_MULTICAST_LOOP, &loop, sizeof(loop)) == -1) {
+            std::cout << "couldn't set up multicast\n";
+            exit(EXIT_FAILURE);
+        }
+        multicast = true;
+    }
+
+    if (use_uring) {
+        try {
+            reactor.reset(new UringReactor());
+        } catch (ReactorError const &e) {
+            std::cerr << e.what() << ", falling back to poll\n";
+        }
+    }
+    if (!reactor) {
+        reactor.reset(new PollReactor());
+    }
+    reactor->add_socket(fd);
+
+    /* Generic segmentation offload is used for catch-up bursts whenever the kernel knows UDP_SEGMENT. */
+    int segment = 0;
+    socklen_t segment_len = sizeof(segment);
+    if (getsockopt(fd, SOL_UDP, UDP_SEGMENT, &segment, &segment_len) == 0) {
+        reactor->enable_gso();
+    }
+
+    /* Real-time mode: everything the loop needs is allocated and locked in memory up front, and ticks are waited
+     * for by polling the sockets for the last REALTIME_SPIN_USEC before the deadline. */
+    if (realtime) {
+        if (!enable_busy_poll(fd)) {
+            std::cerr << "couldn't enable busy polling\n";
+        }
+        game.get_events().reserve(REALTIME_RESERVED_EVENTS);
+        received.reserve(REALTIME_RESERVED_EVENTS);
+        enter_realtime(realtime_cpu, realtime_fifo);
+    }
 
     last_game_tick = 0;
     last_check_timestamp = 0;
+
+    if (handoff_conn != -1) {
+        try {
+            load_state(image);
+        } catch (CodecError const &e) {
+            std::cerr << "Invalid state image\n";
+            exit(EXIT_FAILURE);
+        }
+        if (!ack_handoff(handoff_conn)) {
+            std::cerr << "the old server gave up the handoff\n";
+            exit(EXIT_FAILURE);
+        }
+    }
+
+    if (!handoff_path.empty()) {
+        handoff_fd = listen_handoff(handoff_path);
+        if (handoff_fd == -1) {
+            std::cerr << "couldn't listen for handoffs on " << handoff_path << "\n";
+            exit(EXIT_FAILURE);
+        }
+    }
 }
 
 void Server::run() {
+    clock->update();
     while (true) {
-        polls[0].events = (!active_game && events_to_send.empty()) ? POLLIN : (POLLIN | POLLOUT);
-        polls[0].revents = 0;
-        int ret = poll(polls, 1, -1);
-        if (ret <= 0) {
-            continue;
+        bool check_handoff = false;
+        /* Wait for datagrams until the next tick, or the next inactivity check between games. */
+        uint64_t deadline = game.is_active() ? last_game_tick + SEC_TO_USEC / rounds_per_sec
+                                        : last_check_timestamp + INACTIVE_CHECK_USEC;
+
+        uint64_t started = clock->now();
+        send_multicast();
+        bool blocked = flush_events_to_send(deadline);
+        uint64_t now = clock->update();
+        governor.add(Governor::FANOUT, now - started);
+        metrics.observe(FANOUT_USEC, now - started);
+
+        uint64_t wake = deadline;
+        if (realtime && game.is_active()) {
+            wake = deadline > REALTIME_SPIN_USEC ? deadline - REALTIME_SPIN_USEC : 0;
+        }
+        received.clear();
+        {
+            ALLOC_SCOPE("receive");
+            reactor->wait(clock->wait(wake > now ? wake - now : 0), blocked, received);
         }
+        now = clock->update();
+        started = now;
+
+        if (capture_requested) {
+            capture_requested = 0;
+            dump_capture();
+        }
+        TRACE_POLL();
+        ALLOC_POLL();
 
         /* Check for inactive players and disconnect them if possible. */
-        if ((!active_game && (get_timestamp() - last_check_timestamp >= INACTIVE_CHECK_USEC)) ||
-            (active_game && (get_timestamp() - last_game_tick >= SEC_TO_USEC / rounds_per_sec))) {
-            auto now = get_timestamp();
+        if ((!game.is_active() && (now - last_check_timestamp >= INACTIVE_CHECK_USEC)) ||
+            (game.is_active() && (now - last_game_tick >= SEC_TO_USEC / rounds_per_sec))) {
+            TRACE_SCOPE("sweep");
+            ALLOC_SCOPE("sweep");
             for (auto itr = clients.begin(); itr != clients.end();) {
                 if (now - (*itr).second->get_last_message_time() > INACTIVE_TIMEOUT_USEC) {
                     lobby.remove(itr->second);
+                    if (!itr->second->get_verified()) {
+                        pending_clients--;
+                    }
 
                     itr->second->set_turn_direction(0);
                     itr->second->set_disconnected(true);
+                    close_client_socket(*itr->second);
                     itr = clients.erase(itr);
                 } else
                     ++itr;
             }
             last_check_timestamp = now;
+            check_handoff = handoff_fd != -1;
         }
 
-        /* Process message from client. */
-        if (polls[0].revents & (POLLIN | POLLERR)) {
-            Connection client_conn;
-            Codec p(128);
-            ssize_t dglen =
-                recvfrom(polls[0].fd, p.get_data(), 128, 0, (sockaddr *)client_conn.addr(), client_conn.len_ptr());
-            if (dglen == -1) {
-                std::cout << "Read error\n";
-            } else {
-                process_message_from_client(client_conn, p, dglen);
+        /* Process messages from clients, on the shared socket and on connected ones. Sources sending faster than
+         * any client would are dropped before decoding. The kernel's receive timestamps tell how long each one
+         * waited in the socket, and when it arrived on the loop's clock. */
+        uint64_t wall_ns = received.empty() ? 0 : realtime_ns();
+        for (auto &datagram : received) {
+            metrics.add(DATAGRAMS_IN);
+            ALLOC_DATAGRAM();
+            metrics.add(BYTES_IN, datagram.len);
+            uint64_t arrived = now;
+            if (datagram.received_ns != 0 && datagram.received_ns <= wall_ns) {
+                uint64_t queued = std::min((wall_ns - datagram.received_ns) / 1000, now);
+                metrics.observe(RECEIVE_QUEUE_USEC, queued);
+                arrived = now - queued;
             }
-
-            if (!active_game && lobby.size() >= MIN_PLAYERS_REQUIRED) {
-                if (players_are_ready()) {
-                    restart_game();
-                }
+            if (capture) {
+                capture->record(datagram.from, datagram.data.get_data(), datagram.len, arrived);
+            }
+            if (admission.admit(datagram.from, now)) {
+                process_message_from_client(datagram.from, datagram.data, datagram.len, arrived);
             }
-
-            polls[0].revents &= ~(POLLIN | POLLERR);
         }
 
-        /* Send message to clients if needed. */
-        if (!events_to_send.empty()) {
-            auto len =
-                sendto(polls[0].fd, events_to_send.front().second->get_pos(), events_to_send.front().second->get_len(),
-                       0, (sockaddr *)events_to_send.front().first.addr(), events_to_send.front().first.len());
-            if (len >= 0 || (errno != EWOULDBLOCK && errno != EAGAIN)) {
-                events_to_send.pop();
+        if (replay) {
+            if (!game.is_active() && now >= replay_next_start) {
+                start_replay_game();
+            }
+        } else if (!received.empty() && !game.is_active() && lobby.size() >= MIN_PLAYERS_REQUIRED) {
+            if (players_are_ready()) {
+                restart_game();
             }
         }
+        now = clock->update();
+        governor.add(Governor::INGRESS, now - started);
+        metrics.observe(INGRESS_USEC, now - started);
 
         /* Perform round tick */
-        if (active_game && get_timestamp() - last_game_tick >= SEC_TO_USEC / rounds_per_sec) {
-            round_tick();
-            last_game_tick = get_timestamp();
+        if (game.is_active() && now - last_game_tick >= SEC_TO_USEC / rounds_per_sec) {
+            started = now;
+            if (realtime) {
+                jitter.record(started - last_game_tick - SEC_TO_USEC / rounds_per_sec);
+            }
+            metrics.add(TICKS);
+            ALLOC_TICK();
+            if (started - last_game_tick - SEC_TO_USEC / rounds_per_sec > METRICS_LATE_USEC) {
+                metrics.add(LATE_TICKS);
+            }
+            if (replay) {
+                replay_tick();
+            } else {
+                round_tick();
+            }
+            tick_count++;
+            send_batches();
+
+            last_game_tick = clock->update();
+            governor.add(Governor::TICK, last_game_tick - started);
+            governor.end_tick();
+            metrics.observe(TICK_USEC, last_game_tick - started);
+            update_metrics();
+            if (realtime && !game.is_active()) {
+                report_jitter();
+            }
+        }
+
+        // Between iterations every received datagram is processed, only the send queues are left for the image.
+        if (check_handoff) {
+            try_handoff();
         }
     }
 }
 
-void Server::process_message_from_client(Connection address, Codec p, ssize_t dglen) {
+void Server::process_message_from_client(Connection address, Codec &p, ssize_t dglen, uint64_t arrived) {
+    TRACE_SCOPE("parse");
+    ALLOC_SCOPE("parse");
     p.trim(dglen);
-    if (dglen >= 8 + 1 + 4) {
+    if (dglen >= MIN_HEARTBEAT_LEN && dglen <= MAX_HEARTBEAT_LEN) {
         uint64_t session_id = p.read_uint64_t();
         uint8_t turn_direction = p.read_uint8_t();
         uint32_t next_expected_event_no = p.read_uint32_t();
-        std::string player_name = p.read_string(false);
+        std::string player_name = p.read_string(true);
         try {
             validate_playername(player_name);
         } catch (UtilityError const &e) {
             return;
         }
+        uint32_t datagram_size = negotiate_datagram_size(p);
+        uint8_t flags = p.get_remaining() >= 1 ? p.read_uint8_t() : 0;
+        bool subscriber = multicast && player_name.empty() && (flags & MULTICAST_SUBSCRIBER);
+        uint8_t tier = (flags & REALTIME_UPDATES) ? TIER_REALTIME : TIER_BATCHED;
 
         auto itr = clients.find(address);
         if (itr == clients.end()) {
-            // New client.
+            // New client, unverified until it acknowledges something sent to it.
+            if (pending_clients >= MAX_PENDING_CLIENTS) {
+                return;
+            }
             bool incorrect_nick = false;
 
             for (auto &player : clients)
@@ -191,8 +488,13 @@ void Server::process_message_from_client(Connection address, Codec p, ssize_t dg
             if (!incorrect_nick) {
                 auto player =
                     std::make_shared<Player>(address, player_name, session_id, next_expected_event_no, turn_direction);
-                player->update_last_message_time(get_timestamp());
+                player->update_last_message_time(clock->now());
+                player->set_max_datagram_size(datagram_size);
+                player->set_multicast(subscriber);
+                player->set_tier(tier);
                 clients.insert(std::make_pair(address, player));
+                pending_clients++;
+                open_client_socket(player);
 
                 if (player_name.length() > 0) {
                     lobby.push_back(player);
@@ -207,21 +509,61 @@ void Server::process_message_from_client(Connection address, Codec p, ssize_t dg
             // Already connected client.
             if (itr->second->get_session_id() == session_id) {
                 // Update clients information.
+                uint32_t previous_expected_event_no = itr->second->get_next_expected_event_no();
+                if (turn_direction != itr->second->get_turn_direction() && game.is_active()) {
+                    itr->second->set_input_time(arrived);
+                }
                 itr->second->set_turn_direction(turn_direction);
                 itr->second->set_next_expected_event_no(next_expected_event_no);
-                itr->second->update_last_message_time(get_timestamp());
+                itr->second->update_last_message_time(clock->now());
+                itr->second->set_tier(tier);
                 if (turn_direction != 0 && !itr->second->get_ready()) {
                     itr->second->set_ready(true);
                 }
+                /* Acknowledging exactly the events of the last datagram proves the client receives at its
+                 * address; it gets the rest now. Until then each heartbeat gets at most one datagram back. */
+                if (!itr->second->get_verified()) {
+                    if (next_expected_event_no > previous_expected_event_no &&
+                        next_expected_event_no == itr->second->get_verification_event_no()) {
+                        itr->second->set_verified(true);
+                        pending_clients--;
+                    }
+                    send_message_to_player(itr->second);
+                }
+                /* A batched observer acknowledging less than it was sent after the game ended lost the last
+                 * datagrams, and no batch is coming to bring them again. Having seen the game over, it would
+                 * acknowledge nothing. */
+                if (!game.is_active() && itr->second->get_verified() && !itr->second->get_multicast() &&
+                    is_batched(*itr->second) && next_expected_event_no != 0 &&
+                    next_expected_event_no < previous_expected_event_no) {
+                    send_message_to_player(itr->second);
+                }
+                /* A multicast observer stuck on the same event for two heartbeats has lost a datagram. */
+                if (itr->second->get_multicast() && next_expected_event_no == previous_expected_event_no &&
+                    next_expected_event_no < multicast_sent) {
+                    send_message_to_player(itr->second);
+                }
             } else if (itr->second->get_session_id() < session_id) {
                 // Incorrect session id for this game, sending player to lobby.
+                if (itr->second->get_verified()) {
+                    if (pending_clients >= MAX_PENDING_CLIENTS) {
+                        return;
+                    }
+                    pending_clients++;
+                }
                 lobby.remove(itr->second);
-                active_players.remove(itr->second);
+                game.get_active_players().remove(itr->second);
+                close_client_socket(*itr->second);
                 clients.erase(itr);
 
                 auto player =
                     std::make_shared<Player>(address, player_name, session_id, next_expected_event_no, turn_direction);
+                player->update_last_message_time(clock->now());
+                player->set_max_datagram_size(datagram_size);
+                player->set_multicast(subscriber);
+                player->set_tier(tier);
                 clients.insert(std::make_pair(address, player));
+                open_client_socket(player);
 
                 if (player_name.length() > 0) {
                     lobby.push_back(player);
@@ -234,176 +576,496 @@ void Server::process_message_from_client(Connection address, Codec p, ssize_t dg
     }
 }
 
+/* Clients that want datagrams bigger than the default put a zero byte and their receive size after the name.
+ * They get the smaller of that and the server's limit; legacy clients stay at MAX_DATAGRAM_SIZE. */
+uint32_t Server::negotiate_datagram_size(Codec &p) {
+    if (p.get_remaining() < 4) {
+        return MAX_DATAGRAM_SIZE;
+    }
+    uint32_t requested = p.read_uint32_t();
+    return std::max<uint32_t>(MAX_DATAGRAM_SIZE, std::min(requested, max_datagram_size));
+}
+
 void Server::round_tick() {
-    for (auto itr = active_players.begin(); itr != active_players.end();) {
-        Player &p = **itr;
-        if (p.get_disconnected()) {
-            player_eliminated(p);
-            itr = active_players.erase(itr);
-            if (active_players.size() == WINNING_PLAYERS) {
-                for (auto player : lobby) {
-                    (*player).set_ready(false);
-                }
-                game_over();
-                return;
-            }
-        } else if (p.move(turning_speed)) {
-            if (collision(p) || out_of_map(p)) {
-                player_eliminated(p);
-                lobby.push_back(*itr);
-                itr = active_players.erase(itr);
-
-                if (active_players.size() == WINNING_PLAYERS) {
-                    for (auto player : lobby) {
-                        (*player).set_ready(false);
-                    }
-                    game_over();
-                    return;
-                }
-            } else {
-                pixel(p);
-                itr++;
-            }
-        } else {
-            itr++;
+    TRACE_SCOPE("round_tick");
+    ALLOC_SCOPE("round_tick");
+    std::list<std::shared_ptr<Player> > eliminated;
+    uint64_t started = clock->read();
+    for (auto &player : game.get_active_players()) {
+        if (player->get_input_time() != 0) {
+            metrics.observe(INPUT_AGE_USEC, clock->now() - player->get_input_time());
+            player->set_input_time(0);
+        }
+    }
+    game.tick(eliminated);
+    uint64_t simulated = clock->read();
+    metrics.observe(SIMULATE_USEC, simulated - started);
+    lobby.splice(lobby.end(), eliminated);
+    if (!game.is_active()) {
+        for (auto player : lobby) {
+            (*player).set_ready(false);
+        }
+        if (archive_fd != -1 && !write_archived_game(archive_fd, game, rounds_per_sec)) {
+            std::cerr << "couldn't write game to archive\n";
         }
     }
+    send_events();
+    metrics.observe(PACK_USEC, clock->read() - simulated);
 }
 
-bool Server::players_are_ready() {
-    for (auto player : lobby) {
-        if (!player->get_ready()) {
-            return false;
+/* Starts serving the next archived game, paced by its own rate times the replay speed. It gets a fresh game id like
+ * any new game: clients ignore events under the id of the game that just ended, which replaying the same archived
+ * game again would reuse. */
+void Server::start_replay_game() {
+    /* Games whose indices would lead outside of their records are skipped. */
+    for (size_t skipped = 0; !replay->is_valid(replay_game); skipped++) {
+        if (skipped + 1 == replay->get_game_count()) {
+            std::cerr << "no valid games in archive\n";
+            exit(EXIT_FAILURE);
         }
+        replay_game = (replay_game + 1) % replay->get_game_count();
     }
-    return true;
+    ArchivedGame const &archived = replay->get_game(replay_game);
+    send_multicast();
+    multicast_sent = 0;
+    for (auto client : clients) {
+        client.second->set_next_expected_event_no(0);
+    }
+
+    game.get_events().clear();
+    game.set_game_id(game.get_generator().next());
+    game.set_active(true);
+    rounds_per_sec = std::min<uint32_t>(std::max<uint32_t>(archived.rounds_per_sec, MIN_ROUNDS_PER_SEC) * replay_speed,
+                                        MAX_ROUNDS_PER_SEC);
+    governor.set_budget(SEC_TO_USEC / rounds_per_sec);
+
+    replay_tick_no = 0;
+    append_replay_tick();
+    last_game_tick = clock->now();
+    send_events();
 }
 
-/* Checks for collision of the player. Returns true on collision, false otherwise. */
-bool Server::collision(Player &p) {
-    std::pair<uint32_t, uint32_t> position{p.get_x(), p.get_y()};
-    return used_pixels.find(position) != used_pixels.end();
+void Server::replay_tick() {
+    replay_tick_no++;
+    append_replay_tick();
+    send_events();
 }
 
-/* Checks whether player is out of the map. Returns true if player is out of the map, false otherwise */
-bool Server::out_of_map(Player &p) {
-    return floor(p.get_x()) >= maxx || floor(p.get_x()) < 0 || floor(p.get_y()) >= maxy || floor(p.get_y()) < 0;
-    ;
+/* Appends the events of the current tick of the archived game to the log. Past its last event the game is over,
+ * and the next archived one starts after a pause. */
+void Server::append_replay_tick() {
+    ArchivedGame const &archived = replay->get_game(replay_game);
+    uint32_t end = archived.first_event_of_tick(replay_tick_no + 1);
+    auto &events = game.get_events();
+    for (uint32_t n = archived.first_event_of_tick(replay_tick_no); n < end; n++) {
+        uint32_t len;
+        char const *data = archived.event(n, len);
+        auto event = std::make_shared<Codec>();
+        event->add((void *)data, len);
+        events.push_back(event);
+    }
+
+    if (events.size() >= archived.event_count) {
+        game.set_active(false);
+        replay_game = (replay_game + 1) % replay->get_game_count();
+        replay_next_start = clock->now() + REPLAY_PAUSE_USEC;
+    }
 }
 
-void Server::pixel(Player &p) {
-    auto event = std::make_shared<Codec>();
-    event->add_uint32_t(4 + 1 + 1 + 4 + 4);  // len
-    event->add_uint32_t(events.size());
-    event->add_uint8_t(1);
-    event->add_uint8_t(p.get_game_id());
-    event->add_uint32_t(floor(p.get_x()));
-    event->add_uint32_t(floor(p.get_y()));
-    event->add_uint32_t(get_crc32(event->get_pos(), 4 + 4 + 1 + 1 + 4 + 4));
+/* Gives the client its own UDP socket bound to the server port and connected to the client's address, so
+ * the kernel routes its datagrams there and sends skip the per-packet route lookup. On failure the client
+ * keeps using the shared socket. */
+void Server::open_client_socket(std::shared_ptr<Player> &p) {
+    if (!connected_sockets) {
+        return;
+    }
 
-    std::pair<uint32_t, uint32_t> position{floor(p.get_x()), floor(p.get_y())};
-    used_pixels.insert(position);
+    int client_fd = socket(AF_INET6, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (client_fd == -1) {
+        return;
+    }
 
-    send_message_to_all_players(event);
-}
+    sockaddr_in6 ip;
+    memset(&ip, 0, sizeof(sockaddr_in6));
+    ip.sin6_family = AF_INET6;
+    ip.sin6_port = htobe16(port);
+    ip.sin6_addr = in6addr_any;
+
+    int flag = 1;
+    Connection const &conn = p->get_connection_attr();
+    if (setsockopt(client_fd, SOL_SOCKET, SO_REUSEPORT, &flag, sizeof(flag)) == -1 ||
+        (length_filter && !attach_length_filter(client_fd, MIN_HEARTBEAT_LEN, MAX_HEARTBEAT_LEN)) ||
+        bind(client_fd, (sockaddr *)&ip, sizeof(ip)) < 0 ||
+        connect(client_fd, (sockaddr const *)conn.addr(), conn.len()) < 0) {
+        close(client_fd);
+        return;
+    }
+    if (realtime) {
+        enable_busy_poll(client_fd);
+    }
+    enable_receive_timestamps(client_fd);
 
-void Server::player_eliminated(Player &p) {
-    auto event = std::make_shared<Codec>();
-    event->add_uint32_t(4 + 1 + 1);  // len
-    event->add_uint32_t(events.size());
-    event->add_uint8_t(2);
-    event->add_uint8_t(p.get_game_id());
-    event->add_uint32_t(get_crc32(event->get_pos(), 4 + 4 + 1 + 1));
+    p->set_socket(client_fd);
+    reactor->add_socket(client_fd);
+}
 
-    send_message_to_all_players(event);
+void Server::close_client_socket(Player &p) {
+    if (p.get_socket() != -1) {
+        reactor->remove_socket(p.get_socket());
+        p.close_socket();
+    }
 }
 
-void Server::game_over() {
-    auto event = std::make_shared<Codec>();
-    event->add_uint32_t(4 + 1);  // len
-    event->add_uint32_t(events.size());
-    event->add_uint8_t(3);
-    event->add_uint32_t(get_crc32(event->get_pos(), 4 + 4 + 1));
+/* Observers are clients without a name, they never join the lobby. */
+bool Server::is_observer(Player &p) {
+    return p.get_name().empty();
+}
 
-    active_game = false;
-    send_message_to_all_players(event);
+/* Observers are batched unless they asked for real-time updates, or the governor slowed all of them down. */
+bool Server::is_batched(Player &p) {
+    return is_observer(p) && (p.get_tier() == TIER_BATCHED || governor.observer_stride() > 1);
 }
 
-void Server::send_message_to_all_players(std::shared_ptr<Codec> event) {
-    events.push_back(event);
+bool Server::players_are_ready() {
+    for (auto player : lobby) {
+        if (!player->get_ready()) {
+            return false;
+        }
+    }
+    return true;
+}
 
+/* Sends new events to every client that gets them as they happen. */
+void Server::send_events() {
+    TRACE_SCOPE("pack");
+    ALLOC_SCOPE("pack");
+    /* Unverified clients are answered only when they send a heartbeat, batched ones every few ticks. */
     for (auto client : clients) {
-        send_message_to_player(client.second);
+        if (!client.second->get_multicast() && client.second->get_verified() && !is_batched(*client.second)) {
+            send_message_to_player(client.second);
+        }
+    }
+}
+
+/* Batched clients get everything since their last update every batch_ticks ticks or batch_msec milliseconds,
+ * whichever comes first, and at the end of a game. The governor stretches the tick interval further when
+ * observers have to be slowed down. */
+void Server::send_batches() {
+    TRACE_SCOPE("pack_batches");
+    ALLOC_SCOPE("pack_batches");
+    uint64_t now = clock->now();
+    if (tick_count - last_batch_tick < (uint64_t)batch_ticks * governor.observer_stride() &&
+        (batch_msec == 0 || now - last_batch_time < (uint64_t)batch_msec * 1000) && game.is_active()) {
+        return;
+    }
+    last_batch_tick = tick_count;
+    last_batch_time = now;
+
+    for (auto &client : clients) {
+        if (!client.second->get_multicast() && client.second->get_verified() && is_batched(*client.second)) {
+            send_message_to_player(client.second);
+        }
     }
 }
 
-/* Tries to pack as many possible events in one datagram and proceeds to send it to player */
+/* Sends events that were not multicast yet to the group, in datagrams every observer can receive. */
+void Server::send_multicast() {
+    if (!multicast) {
+        return;
+    }
+    auto &events = game.get_events();
+    while (multicast_sent < events.size()) {
+        auto datagram = pack_events(events, game.get_game_id(), multicast_sent, MAX_DATAGRAM_SIZE);
+        uint32_t sent = 0;
+        reactor->send(fd, &multicast_group, datagram, 0, sent);
+        metrics.add(DATAGRAMS_OUT);
+        metrics.add(BYTES_OUT, datagram->get_len());
+    }
+}
+
+/* Queues every event the player has not seen yet, packed into as few datagrams as possible. A client that is
+ * not verified yet gets a single default sized datagram, so that spoofed heartbeats cannot be amplified into
+ * the whole event history. That datagram is cut at a random size, so that the event a client has to acknowledge
+ * cannot be predicted without receiving it.
+ *
+ * What a batched observer is sent is assumed delivered, so that it can acknowledge rarely: its next update starts
+ * after it, and only a heartbeat acknowledging less, as one does after a lost datagram, winds it back. */
 void Server::send_message_to_player(std::shared_ptr<Player> &p) {
-    uint32_t client_next_expected_no = p->get_next_expected_event_no();
-    while (client_next_expected_no < events.size()) {
-        auto event = std::make_shared<Codec>();
-        event->add_uint32_t(game_id);
-        while (client_next_expected_no < events.size() &&
-               event->get_len() + events[client_next_expected_no]->get_len() <= MAX_DATAGRAM_SIZE) {
-            event->add(events[client_next_expected_no]->get_pos(), events[client_next_expected_no]->get_len());
-            client_next_expected_no++;
+    auto &events = game.get_events();
+    uint32_t game_id = game.get_game_id();
+    if (!p->get_verified()) {
+        uint32_t next_event_no = p->get_next_expected_event_no();
+        if (next_event_no < events.size()) {
+            uint32_t first = std::min<uint32_t>(4 + events[next_event_no]->get_len(), MAX_DATAGRAM_SIZE);
+            uint32_t size = std::uniform_int_distribution<uint32_t>(first, MAX_DATAGRAM_SIZE)(verification_rng);
+            events_to_send.push(OutgoingDatagram{p, pack_events(events, game_id, next_event_no, size), 0});
+            p->set_verification_event_no(next_event_no);
         }
-        events_to_send.push(std::make_pair(p->get_connection_attr(), event));
-        polls[0].revents |= POLLOUT;
+        return;
+    }
+    if (game.is_active() && governor.postpone_observers() && is_observer(*p)) {
+        pack_events_for_player(events, game_id, p, reactor->gso_enabled(), postponed_to_send);
+        while (postponed_to_send.size() > MAX_POSTPONED_DATAGRAMS) {
+            // Dropped events are sent again once the observer acknowledges the event before them.
+            postponed_to_send.pop();
+        }
+    } else {
+        pack_events_for_player(events, game_id, p, reactor->gso_enabled(), events_to_send);
+    }
+    if (!p->get_multicast() && is_batched(*p)) {
+        p->set_next_expected_event_no(events.size());
     }
 }
 
-void Server::restart_game() {
-    game_id = gen.next();
+/* Hands queued datagrams to the reactor, on the client's connected socket or on the shared one, until the
+ * sockets cannot take more. Postponed observer datagrams only go out while a quarter of the tick is left
+ * before deadline. Returns true if the sockets are full. */
+bool Server::flush_events_to_send(uint64_t deadline) {
+    TRACE_SCOPE("flush");
+    ALLOC_SCOPE("flush");
+    uint64_t slack = SEC_TO_USEC / rounds_per_sec / 4;
+    while (!events_to_send.empty() || !postponed_to_send.empty()) {
+        bool postponed = events_to_send.empty();
+        if (postponed && game.is_active() && governor.postpone_observers() && clock->read() + slack > deadline) {
+            return false;
+        }
+        std::queue<OutgoingDatagram> &queue = postponed ? postponed_to_send : events_to_send;
+        OutgoingDatagram &d = queue.front();
+        Player &p = *d.player;
+        bool sent = p.get_socket() != -1
+                        ? reactor->send(p.get_socket(), nullptr, d.data, d.segment_size, d.sent)
+                        : reactor->send(fd, &p.get_connection_attr(), d.data, d.segment_size, d.sent);
+        if (!sent) {
+            return true;
+        }
+        metrics.add(DATAGRAMS_OUT, d.segment_size != 0 ? (d.data->get_len() + d.segment_size - 1) / d.segment_size : 1);
+        metrics.add(BYTES_OUT, d.data->get_len());
+        queue.pop();
+    }
+    return false;
+}
 
-    events.clear();
-    used_pixels.clear();
-    active_players.clear();
-    lobby.remove_if([](std::shared_ptr<Player> const &p) { return p->get_disconnected(); });
-    lobby.sort([](const std::shared_ptr<Player> &p, const std::shared_ptr<Player> &p2) {
-        return p->get_name() < p2->get_name();
-    });
+/* Hands the socket and the game over to a new server process waiting on the handoff socket, and exits once it
+ * took over. The game stands still until the new process is ready, so it is given about a tick; if it is not
+ * ready by then this server goes on and the new one exits. */
+void Server::try_handoff() {
+    int conn = accept4(handoff_fd, nullptr, nullptr, SOCK_CLOEXEC);
+    if (conn == -1) {
+        return;
+    }
+    auto image = save_state();
+    int wait_msec = std::max<int>(HANDOFF_MIN_WAIT_MSEC, SEC_TO_USEC / rounds_per_sec / 1000);
+    if (send_handoff(conn, fd, *image, wait_msec)) {
+        exit(EXIT_SUCCESS);
+    }
+    close(conn);
+}
 
-    uint32_t len = 0;
-    for (auto &p : lobby) {
-        len += p->get_name().length() + 1;
+/* Samples the sizes of the server's state after a tick. */
+void Server::update_metrics() {
+    uint32_t observers = 0;
+    for (auto &client : clients) {
+        observers += is_observer(*client.second);
+    }
+    auto &pixels = game.get_used_pixels();
+    metrics.set(SEND_QUEUE, events_to_send.size() + postponed_to_send.size());
+    metrics.set(CLIENTS, clients.size());
+    metrics.set(OBSERVERS, observers);
+    metrics.set(EVENTS, game.get_events().size());
+    metrics.set(COLLISION_PIXELS, pixels.size());
+    // A set node holds the pixel, three pointers and its red-black color.
+    metrics.set(COLLISION_BYTES, pixels.size() * (sizeof(*pixels.begin()) + 4 * sizeof(void *)));
+}
+
+void Server::dump_capture() {
+    if (capture && !capture->dump(capture_path)) {
+        std::cerr << "couldn't write capture to " << capture_path << "\n";
     }
+}
 
-    auto event = std::make_shared<Codec>();
-    event->add_uint32_t(4 + 1 + 4 + 4 + len);
-    event->add_uint32_t(events.size());
-    event->add_uint8_t(0);
-    event->add_uint32_t(maxx);
-    event->add_uint32_t(maxy);
+/* Game state image: settings the game depends on, game progress, then every player once, followed by the
+ * clients, lobby and active_players as indices into them, the event log, the used pixels, where ticks start and
+ * the datagrams still queued for sending. */
+std::shared_ptr<Codec> Server::save_state() {
+    auto image = std::make_shared<Codec>();
+    image->add_uint32_t(HANDOFF_MAGIC);
+    image->add_uint32_t(game.get_width());
+    image->add_uint32_t(game.get_height());
+    image->add_uint32_t(game.get_turning_speed());
+    image->add_uint32_t(game.get_game_id());
+    image->add_uint8_t(game.is_active());
+    image->add_uint64_t(game.get_generator().get_state());
+    image->add_uint64_t(last_game_tick);
+    image->add_uint64_t(tick_count);
+    image->add_uint32_t(multicast_sent);
 
-    uint8_t player_id = 0;
+    std::map<Player *, uint32_t> index;
+    std::vector<std::shared_ptr<Player> > players;
+    auto number = [&index, &players](std::shared_ptr<Player> const &p) {
+        auto inserted = index.insert(std::make_pair(p.get(), players.size()));
+        if (inserted.second) {
+            players.push_back(p);
+        }
+        return inserted.first->second;
+    };
+    std::vector<uint32_t> client_numbers, lobby_numbers, active_numbers;
+    for (auto &client : clients) {
+        client_numbers.push_back(number(client.second));
+    }
     for (auto &p : lobby) {
-        uint32_t new_x = gen.next() % maxx;
-        uint32_t new_y = gen.next() % maxy;
-        uint32_t new_rotation = gen.next() % 360;
-        p->set_new_position(new_x + 0.5, new_y + 0.5);
-        p->set_rotation(new_rotation);
-        p->set_game_id(player_id++);
-        active_players.push_back(p);
-        event->add_string(p->get_name(), true);
+        lobby_numbers.push_back(number(p));
+    }
+    for (auto &p : game.get_active_players()) {
+        active_numbers.push_back(number(p));
+    }
+    // Queued datagrams keep their queue, 0 for events_to_send and 1 for postponed_to_send.
+    std::vector<std::pair<uint8_t, OutgoingDatagram> > queued;
+    std::queue<OutgoingDatagram> const *queues[] = {&events_to_send, &postponed_to_send};
+    for (uint8_t q = 0; q < 2; q++) {
+        for (auto copy = *queues[q]; !copy.empty(); copy.pop()) {
+            number(copy.front().player);
+            queued.push_back(std::make_pair(q, copy.front()));
+        }
     }
 
-    for (auto client : clients) {
-        client.second->set_next_expected_event_no(0);
+    image->add_uint32_t(players.size());
+    for (auto &p : players) {
+        p->save(*image);
+    }
+    for (auto numbers : {&client_numbers, &lobby_numbers, &active_numbers}) {
+        image->add_uint32_t(numbers->size());
+        for (auto n : *numbers) {
+            image->add_uint32_t(n);
+        }
     }
-    event->add_uint32_t(get_crc32(event->get_pos(), 4 + 4 + 1 + 4 + 4 + len));
 
-    send_message_to_all_players(event);
+    image->add_uint32_t(game.get_events().size());
+    for (auto &event : game.get_events()) {
+        image->add_uint32_t(event->get_len());
+        image->add(event->get_data(), event->get_len());
+    }
 
-    for (auto &p : lobby) {
-        if (collision(*p)) {
-            player_eliminated(*p);
-        } else {
-            pixel(*p);
+    image->add_uint32_t(game.get_used_pixels().size());
+    for (auto &pixel : game.get_used_pixels()) {
+        image->add_uint32_t(pixel.first);
+        image->add_uint32_t(pixel.second);
+    }
+
+    image->add_uint32_t(game.get_tick_starts().size());
+    for (auto start : game.get_tick_starts()) {
+        image->add_uint32_t(start);
+    }
+
+    image->add_uint32_t(queued.size());
+    for (auto &q : queued) {
+        image->add_uint8_t(q.first);
+        image->add_uint32_t(index[q.second.player.get()]);
+        image->add_uint32_t(q.second.segment_size);
+        // Datagrams that already went out are left behind.
+        image->add_uint32_t(q.second.data->get_len() - q.second.sent);
+        image->add(q.second.data->get_data() + q.second.sent, q.second.data->get_len() - q.second.sent);
+    }
+    return image;
+}
+
+/* Restores the game from an image written by save_state(). Throws CodecError if the image is malformed. */
+void Server::load_state(Codec &image) {
+    if (image.read_uint32_t() != HANDOFF_MAGIC) {
+        throw CodecError("Invalid state image\n");
+    }
+    uint32_t maxx = image.read_uint32_t();
+    uint32_t maxy = image.read_uint32_t();
+    game.set_settings(maxx, maxy, image.read_uint32_t());
+    game.set_game_id(image.read_uint32_t());
+    game.set_active(image.read_uint8_t());
+    game.get_generator().set_seed(image.read_uint64_t());
+    last_game_tick = image.read_uint64_t();
+    tick_count = image.read_uint64_t();
+    multicast_sent = image.read_uint32_t();
+
+    uint32_t player_count = image.read_uint32_t();
+    if (player_count > image.get_remaining()) {
+        throw CodecError("Invalid state image\n");
+    }
+    std::vector<std::shared_ptr<Player> > players(player_count);
+    for (auto &p : players) {
+        p = Player::load(image);
+    }
+    auto read_player = [&image, &players]() {
+        uint32_t n = image.read_uint32_t();
+        if (n >= players.size()) {
+            throw CodecError("Invalid state image\n");
+        }
+        return players[n];
+    };
+    for (uint32_t count = image.read_uint32_t(); count > 0; count--) {
+        auto p = read_player();
+        clients.insert(std::make_pair(p->get_connection_attr(), p));
+        open_client_socket(p);
+        if (!p->get_verified()) {
+            pending_clients++;
+        }
+    }
+    for (uint32_t count = image.read_uint32_t(); count > 0; count--) {
+        lobby.push_back(read_player());
+    }
+    for (uint32_t count = image.read_uint32_t(); count > 0; count--) {
+        game.get_active_players().push_back(read_player());
+    }
+
+    for (uint32_t count = image.read_uint32_t(); count > 0; count--) {
+        uint32_t len = image.read_uint32_t();
+        if (image.get_remaining() < len) {
+            throw CodecError("Invalid state image\n");
+        }
+        auto event = std::make_shared<Codec>();
+        event->add(image.get_pos(), len);
+        image.skip_pos(len);
+        game.get_events().push_back(event);
+    }
+
+    for (uint32_t count = image.read_uint32_t(); count > 0; count--) {
+        uint32_t x = image.read_uint32_t();
+        game.get_used_pixels().insert(std::make_pair(x, image.read_uint32_t()));
+    }
+
+    for (uint32_t count = image.read_uint32_t(); count > 0; count--) {
+        game.get_tick_starts().push_back(image.read_uint32_t());
+    }
+
+    for (uint32_t count = image.read_uint32_t(); count > 0; count--) {
+        bool postponed = image.read_uint8_t();
+        auto p = read_player();
+        uint16_t segment_size = image.read_uint32_t();
+        uint32_t len = image.read_uint32_t();
+        if (image.get_remaining() < len) {
+            throw CodecError("Invalid state image\n");
         }
+        auto data = std::make_shared<Codec>();
+        data->add(image.get_pos(), len);
+        image.skip_pos(len);
+        (postponed ? postponed_to_send : events_to_send).push(OutgoingDatagram{p, data, segment_size});
+    }
+}
+
+/* Reports how late the ticks of the last game woke up. */
+void Server::report_jitter() {
+    std::cerr << "Tick wake-up jitter over " << jitter.get_samples() << " ticks: p50 " << jitter.percentile(0.5)
+              << "us, p99 " << jitter.percentile(0.99) << "us, p999 " << jitter.percentile(0.999) << "us\n";
+    jitter.reset();
+}
+
+void Server::restart_game() {
+    send_multicast();
+    multicast_sent = 0;
+    lobby.remove_if([](std::shared_ptr<Player> const &p) { return p->get_disconnected(); });
+    for (auto client : clients) {
+        client.second->set_next_expected_event_no(0);
+        client.second->set_input_time(0);
     }
 
+    game.start(lobby);
     lobby.clear();
-    active_game = true;
-    last_game_tick = get_timestamp();
+    last_game_tick = clock->now();
+    send_events();
 }
\ No newline at end of file
@@ -1,10 +1,21 @@
 #ifndef SK2_SERVER
 #define SK2_SERVER
 
+#include "admission.h"
+#include "archive.h"
+#include "capture.h"
+#include "clock.h"
 #include "codec.h"
 #include "connection.h"
 #include "player.h"
-#include "generator.h"
+#include "game.h"
+#include "governor.h"
+#include "handoff.h"
+#include "metrics.h"
+#include "packing.h"
+#include "protocol.h"
+#include "reactor.h"
+#include "realtime.h"
 
 #include <poll.h>
 #include <map>
@@ -12,6 +23,7 @@
 #include <list>
 #include <unordered_set>
 #include <queue>
+#include <random>
 #include <set>
 #include <cstring>
 #include <sys/socket.h>
@@ -22,65 +34,129 @@
 #define DEFAULT_ROUNDS_PER_SEC 50
 #define DEFAULT_WIDTH 640
 #define DEFAULT_HEIGHT 480
+#define DEFAULT_MULTICAST_PORT 2022
 
 #define MAX_PORT 65535
 #define MIN_ROUNDS_PER_SEC 1
 #define MAX_ROUNDS_PER_SEC 1000
 
 #define INACTIVE_CHECK_USEC 50000
-#define SEC_TO_USEC 1000 * 1000
-#define INACTIVE_TIMEOUT_USEC 2 * SEC_TO_USEC
+#define SEC_TO_USEC (1000 * 1000)
 
 #define MIN_WIDTH 100
 #define MAX_WIDTH 4000
 #define MIN_HEIGHT 100
 #define MAX_HEIGHT 4000
 
-#define MAX_DATAGRAM_SIZE 548
+#define DEFAULT_BATCH_TICKS 1
+#define MAX_BATCH_TICKS 1000
+#define MAX_BATCH_MSEC 10000
+
+#define MIN_HEARTBEAT_LEN (8 + 1 + 4)
+#define MAX_HEARTBEAT_LEN (MIN_HEARTBEAT_LEN + 20 + 1 + 4 + 1)
+#define MAX_PENDING_CLIENTS 64
+
+#define MAX_POSTPONED_DATAGRAMS 4096
+#define REALTIME_RESERVED_EVENTS (64 * 1024)
+
+#define REPLAY_PAUSE_USEC (3 * SEC_TO_USEC)
+#define MAX_REPLAY_SPEED 100
 
 #define MIN_PLAYERS_REQUIRED 2
-#define WINNING_PLAYERS 1
+
+#define HANDOFF_MIN_WAIT_MSEC 20 // a tick at the default rate
 
 class Server {
 private:
-    uint32_t maxx = DEFAULT_WIDTH, maxy = DEFAULT_HEIGHT;
-    std::set<std::pair<uint32_t, uint32_t> > used_pixels;
+    Game game;
     uint32_t rounds_per_sec = DEFAULT_ROUNDS_PER_SEC;
-    uint32_t turning_speed = DEFAULT_TURNING_SPEED;
-    uint32_t game_id;
+
+    uint32_t port = DEFAULT_PORT;
+    bool connected_sockets = false;
+    bool use_uring = false;
+    uint32_t max_datagram_size = MAX_DATAGRAM_SIZE;
+
+    bool multicast = false;
+    Connection multicast_group;
+    uint32_t multicast_sent = 0;
+
+    std::unique_ptr<Clock> clock;
+    Admission admission;
+    bool length_filter = false;
+    uint32_t pending_clients = 0;
+    std::mt19937 verification_rng{std::random_device{}()};
 
     int fd;
-    pollfd polls[1];
+    std::unique_ptr<Reactor> reactor;
+    std::vector<ReceivedDatagram> received;
 
     std::list<std::shared_ptr<Player> > lobby;
-    std::list<std::shared_ptr<Player> > active_players;
     std::map<Connection, std::shared_ptr<Player> > clients;
-    std::vector<std::shared_ptr<Codec> > events;
 
-    Generator gen;
-    
     uint64_t last_game_tick;
     uint64_t last_check_timestamp;
-    std::queue<std::pair<Connection, std::shared_ptr<Codec> > > events_to_send;
-    bool active_game = false;
+    std::queue<OutgoingDatagram> events_to_send;
+    std::queue<OutgoingDatagram> postponed_to_send;
+
+    uint32_t batch_ticks = DEFAULT_BATCH_TICKS;
+    uint32_t batch_msec = 0;
+    uint64_t last_batch_tick = 0;
+    uint64_t last_batch_time = 0;
+
+    Governor governor;
+    uint64_t tick_count = 0;
+
+    bool realtime = false;
+    uint32_t realtime_cpu = 0;
+    bool realtime_fifo = false;
+    JitterHistogram jitter;
+
+    std::string handoff_path;
+    int handoff_fd = -1;
+
+    int archive_fd = -1;
+    std::unique_ptr<Archive> replay;
+    uint32_t replay_speed = 1;
+    size_t replay_game = 0;
+    uint32_t replay_tick_no = 0;
+    uint64_t replay_next_start = 0;
+
+    std::string capture_path;
+    std::unique_ptr<CaptureRing> capture;
+
+    Metrics metrics;
 
-    void pixel(Player &p);
-    void player_eliminated(Player &p);
-    void game_over();
     void round_tick();
-    bool out_of_map(Player &p);
-    bool collision(Player &p);
+    void start_replay_game();
+    void replay_tick();
+    void append_replay_tick();
 
     void restart_game();
+    void report_jitter();
 
-    void send_message_to_all_players(std::shared_ptr<Codec> event);
+    std::shared_ptr<Codec> save_state();
+    void load_state(Codec &image);
+    void try_handoff();
+    void dump_capture();
+    void update_metrics();
+
+    void send_events();
     void send_message_to_player(std::shared_ptr<Player> &p);
+    void send_batches();
+    void send_multicast();
+    bool flush_events_to_send(uint64_t deadline);
+
+    void process_message_from_client(Connection address, Codec &p, ssize_t dglen, uint64_t arrived);
+    uint32_t negotiate_datagram_size(Codec &p);
 
-    void process_message_from_client(Connection address, Codec p, ssize_t dglen);
+    void open_client_socket(std::shared_ptr<Player> &p);
+    void close_client_socket(Player &p);
 
     bool players_are_ready();
+    bool is_observer(Player &p);
+    bool is_batched(Player &p);
 public:
-    Server(int argc, char *argv[]);
+    Server(int argc, char *argv[], std::unique_ptr<Clock> clock = std::unique_ptr<Clock>(new MonotonicClock()));
     void run();
 };
 
@@ -0,0 +1,112 @@
+#include "trace.h"
+
+#ifdef SCREEN_WORMS_TRACE
+
+#include <csignal>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <mutex>
+#include <string>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include <vector>
+
+struct TraceSpan {
+    char const *name;
+    uint64_t start_ns;
+    uint64_t end_ns;
+};
+
+/* Spans of one thread; the oldest are overwritten once it is full. */
+struct TraceRing {
+    std::vector<TraceSpan> spans;
+    size_t next = 0;
+    bool wrapped = false;
+    long tid;
+};
+
+static std::mutex rings_mutex;
+static std::vector<TraceRing *> rings;
+static std::string trace_path;
+static volatile sig_atomic_t flush_requested = 0;
+static volatile sig_atomic_t exit_requested = 0;
+static thread_local TraceRing *ring = nullptr;
+
+uint64_t trace_now() {
+    timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * (uint64_t)1000000000 + ts.tv_nsec;
+}
+
+void trace_record(char const *name, uint64_t start_ns, uint64_t end_ns) {
+    if (ring == nullptr) {
+        ring = new TraceRing();
+        ring->spans.resize(TRACE_RING_SPANS);
+        ring->tid = syscall(SYS_gettid);
+        std::lock_guard<std::mutex> lock(rings_mutex);
+        rings.push_back(ring);
+    }
+    ring->spans[ring->next] = TraceSpan{name, start_ns, end_ns};
+    if (++ring->next == ring->spans.size()) {
+        ring->next = 0;
+        ring->wrapped = true;
+    }
+}
+
+/* Writes every ring to the trace file. Rings of other threads are read while they may be written, so their
+ * newest spans can be torn; the loop's own thread is consistent. */
+static void flush() {
+    FILE *file = fopen(trace_path.c_str(), "w");
+    if (file == nullptr) {
+        return;
+    }
+    long pid = getpid();
+    fprintf(file, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    bool first = true;
+    std::lock_guard<std::mutex> lock(rings_mutex);
+    for (TraceRing *r : rings) {
+        size_t count = r->wrapped ? r->spans.size() : r->next;
+        for (size_t i = 0; i < count; i++) {
+            TraceSpan const &s = r->spans[r->wrapped ? (r->next + i) % r->spans.size() : i];
+            fprintf(file, "%s{\"name\":\"%s\",\"ph\":\"X\",\"ts\":%.3f,\"dur\":%.3f,\"pid\":%ld,\"tid\":%ld}",
+                    first ? "" : ",\n", s.name, s.start_ns / 1e3, (s.end_ns - s.start_ns) / 1e3, pid, r->tid);
+            first = false;
+        }
+    }
+    fprintf(file, "\n]}\n");
+    fclose(file);
+}
+
+static void request_flush(int signal) {
+    flush_requested = 1;
+    exit_requested = signal != SIGUSR2;
+}
+
+/* SIGINT and SIGTERM are caught too, so that stopping a traced process from the terminal leaves a trace. */
+void trace_setup(char const *process) {
+    char const *path = getenv("SCREEN_WORMS_TRACE_FILE");
+    trace_path = path != nullptr ? path : std::string(process) + "-" + std::to_string(getpid()) + ".json";
+
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = request_flush;
+    sigemptyset(&action.sa_mask);
+    sigaction(SIGUSR2, &action, nullptr);
+    sigaction(SIGINT, &action, nullptr);
+    sigaction(SIGTERM, &action, nullptr);
+    atexit(flush);
+}
+
+void trace_poll() {
+    if (exit_requested) {
+        exit(EXIT_SUCCESS);
+    }
+    if (flush_requested) {
+        flush_requested = 0;
+        flush();
+    }
+}
+
+#endif
@@ -0,0 +1,48 @@
+#ifndef SK2_TRACE
+#define SK2_TRACE
+
+/* Tracing of event loop phases, compiled in only with -DSCREEN_WORMS_TRACE (make trace). Spans are recorded into a
+ * ring per thread and written as a Chrome/Perfetto JSON trace at exit and on SIGUSR2, to the file named by
+ * SCREEN_WORMS_TRACE_FILE or to <process>-<pid>.json. Without the flag every macro expands to nothing. */
+
+#ifdef SCREEN_WORMS_TRACE
+
+#include <cstdint>
+
+#define TRACE_RING_SPANS 65536
+
+uint64_t trace_now();
+void trace_record(char const *name, uint64_t start_ns, uint64_t end_ns);
+void trace_setup(char const *process);
+void trace_poll();
+
+/* Records a span from its construction until the end of the enclosing scope. */
+class TraceScope {
+private:
+    char const *name;
+    uint64_t start;
+
+public:
+    explicit TraceScope(char const *name) : name(name), start(trace_now()) {}
+    ~TraceScope() {
+        trace_record(name, start, trace_now());
+    }
+};
+
+#define TRACE_JOIN(a, b) a##b
+#define TRACE_SCOPE_AT(name, line) TraceScope TRACE_JOIN(trace_scope_, line)(name)
+#define TRACE_SCOPE(name) TRACE_SCOPE_AT(name, __LINE__)
+/* Flushes at exit and on SIGUSR2; process names the trace. */
+#define TRACE_SETUP(process) trace_setup(process)
+/* Writes the trace if SIGUSR2 arrived, to be called once per loop iteration. */
+#define TRACE_POLL() trace_poll()
+
+#else
+
+#define TRACE_SCOPE(name) do {} while (0)
+#define TRACE_SETUP(process) do {} while (0)
+#define TRACE_POLL() do {} while (0)
+
+#endif
+
+#endif //SK2_TRACE
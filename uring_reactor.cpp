@@ -0,0 +1,453 @@
+#include "trace.h"
+#include "uring_reactor.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <iostream>
+#include <netinet/in.h>
+#include <netinet/udp.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/* Kind of request stored in the top byte of user_data. */
+enum : uint64_t { OP_RECV = 1, OP_SEND = 2, OP_TIMEOUT = 3, OP_IGNORE = 4, OP_PROBE = 5, OP_WRITABLE = 6 };
+
+static uint64_t make_user_data(uint64_t op, uint32_t generation, uint32_t id) {
+    return (op << 56) | ((uint64_t)(generation & 0xffffff) << 32) | id;
+}
+
+ReactorError::ReactorError(char const *err) : std::runtime_error(err) {}
+
+UringReactor::UringReactor()
+    : buffers(URING_BUFFER_COUNT * URING_BUFFER_SIZE), slots(URING_SEND_SLOTS) {
+    io_uring_params params;
+    memset(&params, 0, sizeof(params));
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_COOP_TASKRUN;
+    params.cq_entries = URING_CQ_ENTRIES;
+    ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    if (ring_fd < 0) {
+        // Older kernels do not know the task run hints.
+        memset(&params, 0, sizeof(params));
+        params.flags = IORING_SETUP_CQSIZE;
+        params.cq_entries = URING_CQ_ENTRIES;
+        ring_fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &params);
+    }
+    if (ring_fd < 0) {
+        throw ReactorError("io_uring is not available");
+    }
+    if (!(params.features & IORING_FEAT_SINGLE_MMAP) || !(params.features & IORING_FEAT_NODROP)) {
+        close(ring_fd);
+        throw ReactorError("io_uring is too old");
+    }
+
+    sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    cq_ring_size = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    sq_ring_size = cq_ring_size = std::max(sq_ring_size, cq_ring_size);
+    sq_ring = mmap(nullptr, sq_ring_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                   IORING_OFF_SQ_RING);
+    sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+    sqes = (io_uring_sqe *)mmap(nullptr, sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ring_fd,
+                                IORING_OFF_SQES);
+    buf_ring_size = URING_BUFFER_COUNT * sizeof(io_uring_buf);
+    buf_ring = (io_uring_buf_ring *)mmap(nullptr, buf_ring_size, PROT_READ | PROT_WRITE,
+                                         MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (sq_ring == MAP_FAILED || sqes == MAP_FAILED || buf_ring == MAP_FAILED) {
+        if (sq_ring != MAP_FAILED) munmap(sq_ring, sq_ring_size);
+        if (sqes != MAP_FAILED) munmap(sqes, sqes_size);
+        if (buf_ring != MAP_FAILED) munmap(buf_ring, buf_ring_size);
+        close(ring_fd);
+        throw ReactorError("couldn't map io_uring");
+    }
+    cq_ring = sq_ring;
+    ring_bufs = (io_uring_buf *)buf_ring;
+
+    char *sq = (char *)sq_ring;
+    sq_head = (unsigned *)(sq + params.sq_off.head);
+    sq_tail = (unsigned *)(sq + params.sq_off.tail);
+    sq_mask = *(unsigned *)(sq + params.sq_off.ring_mask);
+    sq_entries = *(unsigned *)(sq + params.sq_off.ring_entries);
+    sq_array = (unsigned *)(sq + params.sq_off.array);
+    sq_local_tail = *sq_tail;
+    char *cq = (char *)cq_ring;
+    cq_head = (unsigned *)(cq + params.cq_off.head);
+    cq_tail = (unsigned *)(cq + params.cq_off.tail);
+    cq_mask = *(unsigned *)(cq + params.cq_off.ring_mask);
+    cqes = (io_uring_cqe *)(cq + params.cq_off.cqes);
+
+    /* Provided buffer ring that multishot receives take their buffers from. */
+    io_uring_buf_reg reg;
+    memset(&reg, 0, sizeof(reg));
+    reg.ring_addr = (uint64_t)buf_ring;
+    reg.ring_entries = URING_BUFFER_COUNT;
+    reg.bgid = URING_BUFFER_GROUP;
+    if (syscall(__NR_io_uring_register, ring_fd, IORING_REGISTER_PBUF_RING, &reg, 1) < 0) {
+        release();
+        throw ReactorError("io_uring lacks provided buffer rings");
+    }
+    for (uint16_t bid = 0; bid < URING_BUFFER_COUNT; bid++) {
+        io_uring_buf &buf = ring_bufs[buf_tail++ & (URING_BUFFER_COUNT - 1)];
+        buf.addr = (uint64_t)(buffers.data() + bid * URING_BUFFER_SIZE);
+        buf.len = URING_BUFFER_SIZE;
+        buf.bid = bid;
+    }
+    __atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+
+    memset(&recv_msg, 0, sizeof(recv_msg));
+    recv_msg.msg_namelen = sizeof(sockaddr_storage);
+    recv_msg.msg_controllen = CMSG_SPACE(sizeof(timespec));
+
+    for (uint32_t i = URING_SEND_SLOTS; i > 0; i--) {
+        free_slots.push_back(i - 1);
+    }
+
+    bool multishot;
+    try {
+        multishot = probe_multishot();
+    } catch (ReactorError const &) {
+        multishot = false;
+    }
+    if (!multishot) {
+        release();
+        throw ReactorError("io_uring lacks multishot recvmsg");
+    }
+}
+
+UringReactor::~UringReactor() {
+    release();
+}
+
+void UringReactor::release() {
+    munmap(sq_ring, sq_ring_size);
+    munmap(sqes, sqes_size);
+    munmap(buf_ring, buf_ring_size);
+    close(ring_fd);
+}
+
+/* Multishot recvmsg came in a later kernel (6.0) than provided buffer rings (5.19), where it fails every time with
+ * -EINVAL. A datagram sent to a loopback socket of our own tells which one it is. */
+bool UringReactor::probe_multishot() {
+    int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+    if (fd == -1) {
+        return false;
+    }
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t len = sizeof(addr);
+    if (bind(fd, (sockaddr *)&addr, len) == -1 || getsockname(fd, (sockaddr *)&addr, &len) == -1 ||
+        sendto(fd, "", 1, 0, (sockaddr *)&addr, len) != 1) {
+        close(fd);
+        return false;
+    }
+    prep_recv(fd, make_user_data(OP_PROBE, 0, fd));
+    while (!probed) {
+        submit(1);
+        reap();
+    }
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = make_user_data(OP_PROBE, 0, fd);
+    sqe->user_data = make_user_data(OP_IGNORE, 0, 0);
+    submit(0);
+    close(fd);
+    return probe_result >= 0;
+}
+
+io_uring_sqe *UringReactor::get_sqe() {
+    if (sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE) >= sq_entries) {
+        submit(0);
+    }
+    unsigned index = sq_local_tail & sq_mask;
+    io_uring_sqe *sqe = &sqes[index];
+    memset(sqe, 0, sizeof(*sqe));
+    sq_array[index] = index;
+    sq_local_tail++;
+    to_submit++;
+    return sqe;
+}
+
+/* Hands queued SQEs to the kernel, waiting for min_complete completions. Interrupted and busy calls (the
+ * completion queue has to be reaped first) are left for the caller's loop to repeat. */
+void UringReactor::submit(unsigned min_complete) {
+    __atomic_store_n(sq_tail, sq_local_tail, __ATOMIC_RELEASE);
+    if (syscall(__NR_io_uring_enter, ring_fd, to_submit, min_complete, min_complete ? IORING_ENTER_GETEVENTS : 0,
+                nullptr, 0) < 0 && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+        throw ReactorError(strerror(errno));
+    }
+    to_submit = sq_local_tail - __atomic_load_n(sq_head, __ATOMIC_ACQUIRE);
+}
+
+/* Completions may queue sends of their own, which can reap again; those wait until cq_head is published. */
+void UringReactor::reap() {
+    unsigned head = *cq_head;
+    unsigned tail = __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE);
+    uint16_t old_buf_tail = buf_tail;
+    for (; head != tail; head++) {
+        complete(cqes[head & cq_mask]);
+    }
+    __atomic_store_n(cq_head, head, __ATOMIC_RELEASE);
+    if (buf_tail != old_buf_tail) {
+        __atomic_store_n(&buf_ring->tail, buf_tail, __ATOMIC_RELEASE);
+    }
+
+    std::vector<Resend> due;
+    due.swap(resends);
+    for (Resend &r : due) {
+        queue_send(r.fd, r.connected ? nullptr : &r.to, r.data, r.offset, r.len, r.segment_size);
+    }
+}
+
+void UringReactor::complete(io_uring_cqe const &cqe) {
+    uint64_t op = cqe.user_data >> 56;
+    uint32_t generation = (cqe.user_data >> 32) & 0xffffff;
+    uint32_t id = cqe.user_data & 0xffffffff;
+
+    if (op == OP_RECV || op == OP_PROBE) {
+        if (op == OP_PROBE) {
+            probed = true;
+            probe_result = cqe.res;
+        }
+        if (op == OP_RECV && (cqe.flags & IORING_CQE_F_BUFFER)) {
+            uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+            char *buffer = buffers.data() + bid * URING_BUFFER_SIZE;
+            size_t headers = sizeof(io_uring_recvmsg_out) + recv_msg.msg_namelen + recv_msg.msg_controllen;
+            if (cqe.res >= (int32_t)headers) {
+                io_uring_recvmsg_out *out = (io_uring_recvmsg_out *)buffer;
+                ReceivedDatagram datagram{(int)id, Connection(), Codec(MAX_RECEIVED_DATAGRAM), 0, 0};
+                socklen_t namelen = std::min((socklen_t)sizeof(sockaddr_storage), (socklen_t)out->namelen);
+                memcpy(datagram.from.addr(), buffer + sizeof(io_uring_recvmsg_out), namelen);
+                *datagram.from.len_ptr() = namelen;
+                // The control data follows the space reserved for the name.
+                msghdr control;
+                memset(&control, 0, sizeof(control));
+                control.msg_control = buffer + sizeof(io_uring_recvmsg_out) + recv_msg.msg_namelen;
+                control.msg_controllen = std::min((size_t)out->controllen, (size_t)recv_msg.msg_controllen);
+                datagram.received_ns = receive_timestamp(control);
+                datagram.len = std::min({(size_t)out->payloadlen, cqe.res - headers, (size_t)MAX_RECEIVED_DATAGRAM});
+                memcpy(datagram.data.get_data(), buffer + headers, datagram.len);
+                pending_received.push_back(std::move(datagram));
+            }
+
+        }
+        if (cqe.flags & IORING_CQE_F_BUFFER) {
+            uint16_t bid = cqe.flags >> IORING_CQE_BUFFER_SHIFT;
+            io_uring_buf &buf = ring_bufs[buf_tail++ & (URING_BUFFER_COUNT - 1)];
+            buf.addr = (uint64_t)(buffers.data() + bid * URING_BUFFER_SIZE);
+            buf.len = URING_BUFFER_SIZE;
+            buf.bid = bid;
+        }
+        if (op == OP_RECV && !(cqe.flags & IORING_CQE_F_MORE)) {
+            /* Multishot receive ended. It is posted again when buffers ran out or a connected socket got an ICMP
+             * error, as poll would read on; any other error would only end it again, so the socket is dropped. */
+            auto itr = sockets.find(id);
+            if (itr != sockets.end() && (itr->second & 0xffffff) == generation) {
+                if (cqe.res >= 0 || cqe.res == -ENOBUFS || cqe.res == -ECONNREFUSED) {
+                    arm_recv(id);
+                } else {
+                    std::cout << "Read error\n";
+                    sockets.erase(itr);
+                }
+            }
+        }
+    } else if (op == OP_SEND) {
+        SendSlot &slot = slots[id];
+        Resend r{slot.fd, slot.msg.msg_name == nullptr, slot.to, std::move(slot.data), 0, slot.iov.iov_len,
+                 slot.segment_size};
+        r.offset = (char *)slot.iov.iov_base - r.data->get_data();
+        free_slots.push_back(id);
+        if (refused) {
+            refused = false;
+            writable = true;
+        }
+        if (cqe.res == -EAGAIN || cqe.res == -EWOULDBLOCK) {
+            blocked.push_back(r);
+        } else if (cqe.res < 0 && r.segment_size != 0 && gso_unsupported(-cqe.res)) {
+            // This burst cannot be segmented on its way out, resend it datagram by datagram.
+            for (size_t offset = r.offset; offset < r.offset + r.len; offset += r.segment_size) {
+                size_t len = std::min((size_t)r.segment_size, r.offset + r.len - offset);
+                resends.push_back(Resend{r.fd, r.connected, r.to, r.data, offset, len, 0});
+            }
+        }
+        // Any other error is the peer's, and its datagrams are dropped like lost ones.
+    } else if (op == OP_WRITABLE) {
+        if (generation == socket_generation(id) && polled_writable.erase(id) > 0) {
+            auto unblocked = std::stable_partition(blocked.begin(), blocked.end(),
+                                                   [id](Resend const &r) { return r.fd != (int)id; });
+            resends.insert(resends.end(), unblocked, blocked.end());
+            blocked.erase(unblocked, blocked.end());
+            writable = true;
+        }
+    } else if (op == OP_TIMEOUT) {
+        timeout_armed = false;
+    }
+}
+
+void UringReactor::prep_recv(int fd, uint64_t user_data) {
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_RECVMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)&recv_msg;
+    sqe->len = 1;
+    sqe->ioprio = IORING_RECV_MULTISHOT;
+    sqe->flags = IOSQE_BUFFER_SELECT;
+    sqe->buf_group = URING_BUFFER_GROUP;
+    sqe->user_data = user_data;
+}
+
+void UringReactor::arm_recv(int fd) {
+    prep_recv(fd, make_user_data(OP_RECV, sockets[fd], fd));
+}
+
+uint32_t UringReactor::socket_generation(int fd) {
+    auto itr = sockets.find(fd);
+    return itr != sockets.end() ? itr->second & 0xffffff : 0;
+}
+
+void UringReactor::add_socket(int fd) {
+    sockets[fd] = ++generation;
+    arm_recv(fd);
+}
+
+void UringReactor::remove_socket(int fd) {
+    auto itr = sockets.find(fd);
+    if (itr == sockets.end()) {
+        return;
+    }
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_ASYNC_CANCEL;
+    sqe->fd = -1;
+    sqe->addr = make_user_data(OP_RECV, itr->second, fd);
+    sqe->user_data = make_user_data(OP_IGNORE, 0, 0);
+
+    // The descriptor may be reused, so nothing blocked on it is sent any more.
+    if (polled_writable.erase(fd) > 0) {
+        sqe = get_sqe();
+        sqe->opcode = IORING_OP_POLL_REMOVE;
+        sqe->fd = -1;
+        sqe->addr = make_user_data(OP_WRITABLE, itr->second, fd);
+        sqe->user_data = make_user_data(OP_IGNORE, 0, 0);
+    }
+    blocked.erase(std::remove_if(blocked.begin(), blocked.end(), [fd](Resend const &r) { return r.fd == fd; }),
+                  blocked.end());
+    sockets.erase(itr);
+}
+
+void UringReactor::queue_send(int fd, Connection const *to, std::shared_ptr<Codec> const &data, size_t offset,
+                              size_t len, uint16_t segment_size) {
+    while (free_slots.empty()) {
+        submit(1);
+        reap();
+    }
+    uint32_t id = free_slots.back();
+    free_slots.pop_back();
+
+    SendSlot &slot = slots[id];
+    slot.data = data;
+    slot.fd = fd;
+    slot.segment_size = segment_size;
+    memset(&slot.msg, 0, sizeof(slot.msg));
+    if (to != nullptr) {
+        slot.to = *to;
+        slot.msg.msg_name = slot.to.addr();
+        slot.msg.msg_namelen = slot.to.len();
+    }
+    slot.iov.iov_base = data->get_data() + offset;
+    slot.iov.iov_len = len;
+    slot.msg.msg_iov = &slot.iov;
+    slot.msg.msg_iovlen = 1;
+    if (segment_size != 0) {
+        memset(slot.control, 0, sizeof(slot.control));
+        slot.msg.msg_control = slot.control;
+        slot.msg.msg_controllen = sizeof(slot.control);
+        cmsghdr *cm = CMSG_FIRSTHDR(&slot.msg);
+        cm->cmsg_level = SOL_UDP;
+        cm->cmsg_type = UDP_SEGMENT;
+        cm->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+        *(uint16_t *)CMSG_DATA(cm) = segment_size;
+    }
+
+    io_uring_sqe *sqe = get_sqe();
+    sqe->opcode = IORING_OP_SENDMSG;
+    sqe->fd = fd;
+    sqe->addr = (uint64_t)&slot.msg;
+    sqe->len = 1;
+    sqe->user_data = make_user_data(OP_SEND, 0, id);
+}
+
+/* Sends are only queued here; they reach the kernel together with the next wait. */
+bool UringReactor::send(int fd, Connection const *to, std::shared_ptr<Codec> const &data, uint16_t segment_size,
+                        uint32_t &sent) {
+    size_t needed = segment_size != 0 && !gso ? (data->get_len() - sent + segment_size - 1) / segment_size : 1;
+    if (blocked.empty() && free_slots.size() < needed) {
+        submit(0);
+        reap();
+    }
+    if (!blocked.empty() || free_slots.size() < needed) {
+        refused = true;
+        return false;
+    }
+    if (segment_size != 0 && !gso) {
+        for (size_t offset = sent; offset < data->get_len(); offset += segment_size) {
+            queue_send(fd, to, data, offset, std::min((size_t)segment_size, data->get_len() - offset), 0);
+        }
+    } else {
+        queue_send(fd, to, data, sent, data->get_len() - sent, segment_size);
+    }
+    sent = data->get_len();
+    return true;
+}
+
+void UringReactor::wait(uint64_t timeout_usec, bool want_write, std::vector<ReceivedDatagram> &received) {
+    TRACE_SCOPE("wait");
+    timeout.tv_sec = timeout_usec / 1000000;
+    timeout.tv_nsec = (timeout_usec % 1000000) * 1000;
+
+    /* One timeout SQE stays armed between waits and is moved to the new deadline. */
+    io_uring_sqe *sqe = get_sqe();
+    sqe->fd = -1;
+    if (!timeout_armed) {
+        sqe->opcode = IORING_OP_TIMEOUT;
+        sqe->addr = (uint64_t)&timeout;
+        sqe->len = 1;
+        sqe->user_data = make_user_data(OP_TIMEOUT, 0, 0);
+        timeout_armed = true;
+    } else {
+        sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+        sqe->addr = make_user_data(OP_TIMEOUT, 0, 0);
+        sqe->off = (uint64_t)&timeout;
+        sqe->timeout_flags = IORING_TIMEOUT_UPDATE;
+        sqe->user_data = make_user_data(OP_IGNORE, 0, 0);
+    }
+
+    /* Sends that found their sockets full wait for them to become writable. */
+    for (Resend const &r : blocked) {
+        if (polled_writable.insert(r.fd).second) {
+            sqe = get_sqe();
+            sqe->opcode = IORING_OP_POLL_ADD;
+            sqe->fd = r.fd;
+            sqe->poll32_events = POLLOUT;
+            sqe->user_data = make_user_data(OP_WRITABLE, socket_generation(r.fd), r.fd);
+        }
+    }
+
+    /* Completions of sends alone do not end the wait, unless send() refused datagrams the caller waits to send. */
+    writable = false;
+    while (pending_received.empty() && timeout_armed && !(want_write && writable)) {
+        if (*cq_head == __atomic_load_n(cq_tail, __ATOMIC_ACQUIRE)) {
+            submit(1);
+        }
+        reap();
+    }
+    if (to_submit > 0) {
+        submit(0);
+    }
+
+    for (auto &datagram : pending_received) {
+        received.push_back(std::move(datagram));
+    }
+    pending_received.clear();
+}
@@ -0,0 +1,122 @@
+#ifndef SK2_URING_REACTOR
+#define SK2_URING_REACTOR
+
+#include "reactor.h"
+
+#include <linux/io_uring.h>
+#include <linux/time_types.h>
+#include <map>
+#include <set>
+#include <stdexcept>
+#include <sys/socket.h>
+
+#define URING_ENTRIES 256
+#define URING_CQ_ENTRIES 4096
+#define URING_SEND_SLOTS 4096
+#define URING_BUFFER_COUNT 1024
+#define URING_BUFFER_SIZE 512
+#define URING_BUFFER_GROUP 0
+
+class ReactorError : public std::runtime_error {
+public:
+    ReactorError(char const *err);
+};
+
+/* Reactor built on io_uring. Every socket has a multishot recvmsg posted which takes its buffers from a
+ * provided buffer ring, sends are queued as SQEs and submitted together, and the wait deadline is a timeout SQE,
+ * so one loop iteration costs at most a single io_uring_enter. Throws ReactorError if the kernel lacks any of
+ * the required features, and from send and wait if io_uring_enter fails for good.
+ *
+ * Sends complete after send() returned, so a send that found its socket full is kept here and sent again once
+ * the socket is writable. Until then, and while every send slot is taken, send() refuses more datagrams, just as
+ * PollReactor does when a socket is full. */
+class UringReactor : public Reactor {
+private:
+    /* Send in flight; its msghdr is read by the kernel until the completion arrives. */
+    struct SendSlot {
+        std::shared_ptr<Codec> data;
+        Connection to;
+        msghdr msg;
+        iovec iov;
+        char control[CMSG_SPACE(sizeof(uint16_t))];
+        uint16_t segment_size;
+        int fd;
+    };
+
+    /* Part of a datagram sent again: a datagram of a burst the kernel refused to segment, sent once the
+     * completions are reaped, or a send that found its socket full, sent once the socket is writable. */
+    struct Resend {
+        int fd;
+        bool connected;
+        Connection to;
+        std::shared_ptr<Codec> data;
+        size_t offset, len;
+        uint16_t segment_size;
+    };
+
+    int ring_fd = -1;
+    void *sq_ring = nullptr;
+    size_t sq_ring_size = 0;
+    void *cq_ring = nullptr;
+    size_t cq_ring_size = 0;
+    io_uring_sqe *sqes = nullptr;
+    size_t sqes_size = 0;
+
+    unsigned *sq_head, *sq_tail, *sq_array;
+    unsigned sq_mask, sq_entries;
+    unsigned sq_local_tail = 0;
+    unsigned to_submit = 0;
+    unsigned *cq_head, *cq_tail;
+    unsigned cq_mask;
+    io_uring_cqe *cqes;
+
+    io_uring_buf_ring *buf_ring = nullptr;
+    /* Entries of buf_ring; its 'bufs' member is misplaced when the kernel header is compiled as C++. */
+    io_uring_buf *ring_bufs = nullptr;
+    size_t buf_ring_size = 0;
+    std::vector<char> buffers;
+    uint16_t buf_tail = 0;
+
+    msghdr recv_msg;
+    std::map<int, uint32_t> sockets;
+    uint32_t generation = 0;
+
+    std::vector<SendSlot> slots;
+    std::vector<uint32_t> free_slots;
+    std::vector<Resend> resends;
+    std::vector<Resend> blocked;
+    std::set<int> polled_writable;
+    bool refused = false;
+    bool writable = false;
+
+    __kernel_timespec timeout;
+    bool timeout_armed = false;
+
+    std::vector<ReceivedDatagram> pending_received;
+    bool probed = false;
+    int32_t probe_result = 0;
+
+    void release();
+    bool probe_multishot();
+    io_uring_sqe *get_sqe();
+    void submit(unsigned min_complete);
+    void reap();
+    void complete(io_uring_cqe const &cqe);
+    void prep_recv(int fd, uint64_t user_data);
+    void arm_recv(int fd);
+    uint32_t socket_generation(int fd);
+    void queue_send(int fd, Connection const *to, std::shared_ptr<Codec> const &data, size_t offset, size_t len,
+                    uint16_t segment_size);
+
+public:
+    UringReactor();
+    ~UringReactor() override;
+
+    void add_socket(int fd) override;
+    void remove_socket(int fd) override;
+    bool send(int fd, Connection const *to, std::shared_ptr<Codec> const &data, uint16_t segment_size,
+              uint32_t &sent) override;
+    void wait(uint64_t timeout_usec, bool want_write, std::vector<ReceivedDatagram> &received) override;
+};
+
+#endif //SK2_URING_REACTOR